@@ -0,0 +1,80 @@
+/*
+Copyright (c) 2015-2019, Lawrence Livermore National Security, LLC.
+
+Produced at the Lawrence Livermore National Laboratory
+
+Written by Simone Atzeni (simone@cs.utah.edu), Joachim Protze
+(joachim.protze@tu-dresden.de), Jonas Hahnfeld
+(hahnfeld@itc.rwth-aachen.de), Ganesh Gopalakrishnan, Zvonimir
+Rakamaric, Dong H. Ahn, Gregory L. Lee, Ignacio Laguna, and Martin
+Schulz.
+
+LLNL-CODE-773957
+
+All rights reserved.
+
+This file is part of Archer. For details, see
+https://pruners.github.io/archer. Please also read
+https://github.com/PRUNERS/archer/blob/master/LICENSE.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+   Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the disclaimer below.
+
+   Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the disclaimer (as noted below)
+   in the documentation and/or other materials provided with the
+   distribution.
+
+   Neither the name of the LLNS/LLNL nor the names of its contributors
+   may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LAWRENCE
+LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// RACE: no
+// The barrier after the nowait loop orders the two loops.
+// Usage: barrier-no [size]
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SIZE(argc, argv) ((argc) > 1 ? atol((argv)[1]) : 1000)
+
+int main(int argc, char* argv[])
+{
+  long n = SIZE(argc, argv);
+  long *a = (long *)calloc(n, sizeof(long));
+  long *b = (long *)calloc(n, sizeof(long));
+
+  #pragma omp parallel
+  {
+    #pragma omp for nowait
+    for (long i = 0; i < n; i++)
+      a[i] = i;
+    #pragma omp barrier
+    #pragma omp for
+    for (long i = 0; i < n; i++)
+      b[i] = a[n - 1 - i];
+  }
+
+  printf("%ld\n", b[0]);
+  free(a);
+  free(b);
+  return 0;
+}
@@ -0,0 +1,259 @@
+/*
+Copyright (c) 2015-2019, Lawrence Livermore National Security, LLC.
+
+Produced at the Lawrence Livermore National Laboratory
+
+Written by Simone Atzeni (simone@cs.utah.edu), Joachim Protze
+(joachim.protze@tu-dresden.de), Jonas Hahnfeld
+(hahnfeld@itc.rwth-aachen.de), Ganesh Gopalakrishnan, Zvonimir
+Rakamaric, Dong H. Ahn, Gregory L. Lee, Ignacio Laguna, and Martin
+Schulz.
+
+LLNL-CODE-773957
+
+All rights reserved.
+
+This file is part of Archer. For details, see
+https://pruners.github.io/archer. Please also read
+https://github.com/PRUNERS/archer/blob/master/LICENSE.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+   Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the disclaimer below.
+
+   Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the disclaimer (as noted below)
+   in the documentation and/or other materials provided with the
+   distribution.
+
+   Neither the name of the LLNS/LLNL nor the names of its contributors
+   may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LAWRENCE
+LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Microbenchmarks for the OpenMP events handled by Archer. Every kernel
+// repeats one construct and reports the time per repetition in nanoseconds
+// as JSON. The same source is built plain, with Archer under ThreadSanitizer,
+// and with Archer's callbacks only (see CMakeLists.txt).
+//
+// Usage: ompt-bench [-n iterations] [-o file.json] [kernel...]
+
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef ARCHER_BENCH_VARIANT
+#define ARCHER_BENCH_VARIANT "plain"
+#endif
+
+#ifdef ARCHER_BENCH_CALLBACKS_ONLY
+// Archer disables itself if the ThreadSanitizer runtime, which defines this
+// function, is not present. Defining it here keeps the callbacks registered
+// while the annotations fall back to Archer's empty definitions.
+int RunningOnValgrind(void) { return 0; }
+#endif
+
+typedef void (*kernel_fn)(long n);
+
+// Opaque body of the constructs, so that the compiler cannot drop them.
+static void __attribute__((noinline)) body(void) {
+  __asm__ volatile("" ::: "memory");
+}
+
+static void bench_parallel(long n) {
+  for (long i = 0; i < n; i++) {
+    #pragma omp parallel
+    body();
+  }
+}
+
+static void bench_barrier(long n) {
+  #pragma omp parallel
+  for (long i = 0; i < n; i++) {
+    #pragma omp barrier
+  }
+}
+
+static void bench_task(long n) {
+  #pragma omp parallel
+  #pragma omp single
+  for (long i = 0; i < n; i++) {
+    #pragma omp task
+    body();
+  }
+}
+
+// Storage the dependences of the tasks refer to.
+static int deps[8];
+
+static void bench_task_deps_1(long n) {
+  #pragma omp parallel
+  #pragma omp single
+  for (long i = 0; i < n; i++) {
+    #pragma omp task depend(inout: deps[0])
+    body();
+  }
+}
+
+static void bench_task_deps_4(long n) {
+  #pragma omp parallel
+  #pragma omp single
+  for (long i = 0; i < n; i++) {
+    #pragma omp task depend(inout: deps[0], deps[1], deps[2], deps[3])
+    body();
+  }
+}
+
+static void bench_task_deps_8(long n) {
+  #pragma omp parallel
+  #pragma omp single
+  for (long i = 0; i < n; i++) {
+    #pragma omp task depend(inout: deps[0], deps[1], deps[2], deps[3], \
+                                 deps[4], deps[5], deps[6], deps[7])
+    body();
+  }
+}
+
+static void bench_taskgroup(long n) {
+  #pragma omp parallel
+  #pragma omp single
+  for (long i = 0; i < n; i++) {
+    #pragma omp taskgroup
+    {
+      #pragma omp task
+      body();
+    }
+  }
+}
+
+static void bench_taskwait(long n) {
+  #pragma omp parallel
+  #pragma omp single
+  for (long i = 0; i < n; i++) {
+    #pragma omp task
+    body();
+    #pragma omp taskwait
+  }
+}
+
+static void bench_lock(long n) {
+  omp_lock_t lock;
+  omp_init_lock(&lock);
+  #pragma omp parallel
+  {
+    #pragma omp for schedule(static)
+    for (long i = 0; i < n; i++) {
+      omp_set_lock(&lock);
+      omp_unset_lock(&lock);
+    }
+  }
+  omp_destroy_lock(&lock);
+}
+
+static void bench_critical(long n) {
+  #pragma omp parallel
+  {
+    #pragma omp for schedule(static)
+    for (long i = 0; i < n; i++) {
+      #pragma omp critical
+      body();
+    }
+  }
+}
+
+static void bench_ordered(long n) {
+  #pragma omp parallel
+  {
+    #pragma omp for ordered schedule(static, 1)
+    for (long i = 0; i < n; i++) {
+      #pragma omp ordered
+      body();
+    }
+  }
+}
+
+static const struct {
+  const char *name;
+  kernel_fn fn;
+} kernels[] = {
+  {"parallel", bench_parallel},
+  {"barrier", bench_barrier},
+  {"task", bench_task},
+  {"task_deps_1", bench_task_deps_1},
+  {"task_deps_4", bench_task_deps_4},
+  {"task_deps_8", bench_task_deps_8},
+  {"taskgroup", bench_taskgroup},
+  {"taskwait", bench_taskwait},
+  {"lock", bench_lock},
+  {"critical", bench_critical},
+  {"ordered", bench_ordered},
+};
+
+#define NUM_KERNELS (sizeof(kernels) / sizeof(kernels[0]))
+
+static int selected(const char *name, int argc, char **argv, int first) {
+  if (first == argc)
+    return 1;
+  for (int i = first; i < argc; i++)
+    if (!strcmp(argv[i], name))
+      return 1;
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  long n = 10000;
+  const char *output = NULL;
+  int first = 1;
+  for (; first < argc && argv[first][0] == '-'; first++) {
+    if (!strcmp(argv[first], "-n") && first + 1 < argc)
+      n = atol(argv[++first]);
+    else if (!strcmp(argv[first], "-o") && first + 1 < argc)
+      output = argv[++first];
+    else {
+      fprintf(stderr, "Usage: %s [-n iterations] [-o file.json] [kernel...]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  FILE *out = output ? fopen(output, "w") : stdout;
+  if (!out) {
+    perror(output);
+    return 1;
+  }
+
+  fprintf(out, "{\"variant\": \"%s\", \"threads\": %d, \"iterations\": %ld, \"results\": [",
+          ARCHER_BENCH_VARIANT, omp_get_max_threads(), n);
+  const char *sep = "";
+  for (unsigned k = 0; k < NUM_KERNELS; k++) {
+    if (!selected(kernels[k].name, argc, argv, first))
+      continue;
+    // Warm up the thread pool and the pools of Archer.
+    kernels[k].fn(n / 10 + 1);
+    double start = omp_get_wtime();
+    kernels[k].fn(n);
+    double ns = (omp_get_wtime() - start) * 1e9 / n;
+    fprintf(out, "%s\n  {\"name\": \"%s\", \"ns_per_op\": %.1f}", sep, kernels[k].name, ns);
+    sep = ",";
+  }
+  fprintf(out, "\n]}\n");
+  if (out != stdout)
+    fclose(out);
+  return 0;
+}
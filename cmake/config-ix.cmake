@@ -19,3 +19,12 @@ function(has_ompt_support path library symbol var)
   endif( NOT TT_OUT EQUAL 0 )
   set( ${var} TRUE PARENT_SCOPE )
 endfunction(has_ompt_support var)
+
+# OpenMP 5.0 reports reductions performed by the runtime
+include(CheckCXXSourceCompiles)
+set(CMAKE_REQUIRED_INCLUDES ${OMPT_INCLUDE_PATH})
+check_cxx_source_compiles("
+#include <ompt.h>
+int main() { return ompt_callback_reduction + ompt_sync_region_reduction; }"
+  LIBARCHER_HAVE_OMPT_REDUCTION)
+unset(CMAKE_REQUIRED_INCLUDES)
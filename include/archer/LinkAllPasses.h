@@ -63,6 +63,11 @@ class ModulePass;
 
 namespace llvm {
 llvm::Pass *createInstrumentParallelPass();
+llvm::Pass *createThreadPrivateAccessesPass();
+llvm::Pass *createReadOnlySharedDataPass();
+llvm::Pass *createDisjointLoopAccessesPass();
+llvm::Pass *createCoalesceLoopAccessesPass();
+llvm::Pass *createInstrumentMemoryAccessesPass();
 }
 
 namespace {
@@ -76,6 +81,11 @@ struct ArcherForcePassLinking {
       return;
 
     llvm::createInstrumentParallelPass();
+    llvm::createThreadPrivateAccessesPass();
+    llvm::createReadOnlySharedDataPass();
+    llvm::createDisjointLoopAccessesPass();
+    llvm::createCoalesceLoopAccessesPass();
+    llvm::createInstrumentMemoryAccessesPass();
   }
 } ArcherForcePassLinking; // Force link by creating a global definition.
 }
@@ -83,6 +93,11 @@ struct ArcherForcePassLinking {
 namespace llvm {
 void createInstrumentParallelPass(llvm::PassRegistry &);
 void initializeInstrumentParallelPass(llvm::PassRegistry&);
+void initializeThreadPrivateAccessesPass(llvm::PassRegistry&);
+void initializeReadOnlySharedDataPass(llvm::PassRegistry&);
+void initializeDisjointLoopAccessesPass(llvm::PassRegistry&);
+void initializeCoalesceLoopAccessesPass(llvm::PassRegistry&);
+void initializeInstrumentMemoryAccessesPass(llvm::PassRegistry&);
 }
 
 #endif
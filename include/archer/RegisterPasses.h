@@ -59,5 +59,6 @@ namespace llvm {
 
   void initializeArcherPasses(llvm::PassRegistry &Registry);
   void registerArcherPasses(llvm::legacy::PassManagerBase &PM);
+  void registerArcherInstrumentationPasses(llvm::legacy::PassManagerBase &PM);
 }
 #endif
@@ -0,0 +1,140 @@
+/*
+Copyright (c) 2015-2019, Lawrence Livermore National Security, LLC.
+
+Produced at the Lawrence Livermore National Laboratory
+
+Written by Simone Atzeni (simone@cs.utah.edu), Joachim Protze
+(joachim.protze@tu-dresden.de), Jonas Hahnfeld
+(hahnfeld@itc.rwth-aachen.de), Ganesh Gopalakrishnan, Zvonimir
+Rakamaric, Dong H. Ahn, Gregory L. Lee, Ignacio Laguna, and Martin
+Schulz.
+
+LLNL-CODE-773957
+
+All rights reserved.
+
+This file is part of Archer. For details, see
+https://pruners.github.io/archer. Please also read
+https://github.com/PRUNERS/archer/blob/master/LICENSE.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+   Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the disclaimer below.
+
+   Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the disclaimer (as noted below)
+   in the documentation and/or other materials provided with the
+   distribution.
+
+   Neither the name of the LLNS/LLNL nor the names of its contributors
+   may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LAWRENCE
+LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef ARCHER_SAFEACCESS_H
+#define ARCHER_SAFEACCESS_H
+
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instruction.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/IR/Module.h"
+
+namespace llvm {
+
+// Loads, stores and memory intrinsics that one of the Archer analyses
+// proved to be race free carry this metadata. The string operand names
+// the proof, e.g. "private". InstrumentMemoryAccesses does not pass
+// them to ThreadSanitizer.
+static const char *const ArcherSafeAccessMD = "archer.safe";
+
+inline void markArcherSafeAccess(Instruction *Inst, StringRef Reason) {
+  LLVMContext &C = Inst->getContext();
+  Inst->setMetadata(ArcherSafeAccessMD, MDNode::get(C, MDString::get(C, Reason)));
+}
+
+inline bool isArcherSafeAccess(const Instruction *Inst) {
+  return Inst->getMetadata(ArcherSafeAccessMD) != nullptr;
+}
+
+inline StringRef getArcherSafeAccessReason(const Instruction *Inst) {
+  MDNode *N = Inst->getMetadata(ArcherSafeAccessMD);
+  if (!N || N->getNumOperands() == 0)
+    return StringRef();
+  if (MDString *S = dyn_cast<MDString>(N->getOperand(0)))
+    return S->getString();
+  return StringRef();
+}
+
+// Outlined OpenMP regions and their helpers are emitted by clang with a
+// ".omp" prefix.
+inline bool isOpenMPOutlinedFunction(const Function &F) {
+  return F.getName().startswith(".omp");
+}
+
+inline bool isForkCall(const Function *F) {
+  return F && (F->getName() == "__kmpc_fork_call" ||
+               F->getName() == "__kmpc_fork_teams");
+}
+
+// Returns the __kmpc_fork_call or __kmpc_fork_teams that U passes a
+// microtask to, or null if U is not such a use.
+inline CallInst *getForkCallOfMicrotask(const Use &U) {
+  const User *Usr = U.getUser();
+  const Use *MicrotaskUse = &U;
+  if (const ConstantExpr *CE = dyn_cast<ConstantExpr>(Usr)) {
+    if (!CE->isCast() || !CE->hasOneUse())
+      return nullptr;
+    MicrotaskUse = &*CE->use_begin();
+    Usr = MicrotaskUse->getUser();
+  }
+  const CallInst *CI = dyn_cast<CallInst>(Usr);
+  if (!CI || !isForkCall(CI->getCalledFunction()) ||
+      MicrotaskUse->getOperandNo() != 2)
+    return nullptr;
+  return const_cast<CallInst *>(CI);
+}
+
+// InstrumentParallel lets every outlined region check on entry whether
+// it runs alone, i.e. no parallel region is active and there is a single
+// team, and in that case call its uninstrumented copy <name>__archer_st__
+// and return. Returns whether Inst is part of that check; it touches no
+// user data and the copy never runs next to other OpenMP code.
+inline bool isArcherSerialDispatch(const Instruction &Inst) {
+  const CallInst *CI = dyn_cast<CallInst>(&Inst);
+  if (!CI || !CI->getCalledFunction())
+    return false;
+  StringRef Name = CI->getCalledFunction()->getName();
+  return Name == "omp_get_active_level" || Name == "omp_get_num_teams" ||
+         Name.endswith("__archer_st__");
+}
+
+inline Function *getOrInsertArcherFunction(Module &M, StringRef Name,
+                                           FunctionType *Ty) {
+#if LLVM_VERSION >= 90
+  return cast<Function>(M.getOrInsertFunction(Name, Ty).getCallee());
+#else
+  return cast<Function>(M.getOrInsertFunction(Name, Ty));
+#endif
+}
+}
+
+#endif
@@ -48,6 +48,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
 #include "archer/LinkAllPasses.h"
+#include "archer/RegisterPasses.h"
 #include "llvm/Analysis/CFGPrinter.h"
 #include "llvm/IR/LegacyPassManager.h"
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
@@ -57,9 +58,40 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 namespace llvm {
 void initializeArcherPasses(llvm::PassRegistry &Registry) {
   initializeInstrumentParallelPass(Registry);
+  initializeThreadPrivateAccessesPass(Registry);
+  initializeReadOnlySharedDataPass(Registry);
+  initializeDisjointLoopAccessesPass(Registry);
+  initializeCoalesceLoopAccessesPass(Registry);
+  initializeInstrumentMemoryAccessesPass(Registry);
 }
 
 void registerArcherPasses(llvm::legacy::PassManagerBase &PM) {
   PM.add(createInstrumentParallelPass());
+  registerArcherInstrumentationPasses(PM);
+}
+
+// The analyses mark race-free accesses, InstrumentMemoryAccesses then
+// instruments everything else. Global extensions run before the
+// ThreadSanitizer pass that clang adds at the same extension points.
+// DisjointLoopAccesses rewrites fork calls and CoalesceLoopAccesses
+// inserts range checks, so they come last.
+void registerArcherInstrumentationPasses(llvm::legacy::PassManagerBase &PM) {
+  PM.add(createThreadPrivateAccessesPass());
+  PM.add(createReadOnlySharedDataPass());
+  PM.add(createDisjointLoopAccessesPass());
+  PM.add(createCoalesceLoopAccessesPass());
+  PM.add(createInstrumentMemoryAccessesPass());
 }
 }
+
+static void registerArcherInstrumentation(const llvm::PassManagerBuilder &,
+                                          llvm::legacy::PassManagerBase &PM) {
+  llvm::registerArcherInstrumentationPasses(PM);
+}
+
+static llvm::RegisterStandardPasses
+    RegisterArcherInstrumentation(llvm::PassManagerBuilder::EP_OptimizerLast,
+                                  registerArcherInstrumentation);
+static llvm::RegisterStandardPasses
+    RegisterArcherInstrumentationO0(llvm::PassManagerBuilder::EP_EnabledOnOptLevel0,
+                                    registerArcherInstrumentation);
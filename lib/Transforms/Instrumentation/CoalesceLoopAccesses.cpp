@@ -0,0 +1,294 @@
+/*
+Copyright (c) 2015-2019, Lawrence Livermore National Security, LLC.
+
+Produced at the Lawrence Livermore National Laboratory
+
+Written by Simone Atzeni (simone@cs.utah.edu), Joachim Protze
+(joachim.protze@tu-dresden.de), Jonas Hahnfeld
+(hahnfeld@itc.rwth-aachen.de), Ganesh Gopalakrishnan, Zvonimir
+Rakamaric, Dong H. Ahn, Gregory L. Lee, Ignacio Laguna, and Martin
+Schulz.
+
+LLNL-CODE-773957
+
+All rights reserved.
+
+This file is part of Archer. For details, see
+https://pruners.github.io/archer. Please also read
+https://github.com/PRUNERS/archer/blob/master/LICENSE.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+   Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the disclaimer below.
+
+   Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the disclaimer (as noted below)
+   in the documentation and/or other materials provided with the
+   distribution.
+
+   Neither the name of the LLNS/LLNL nor the names of its contributors
+   may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LAWRENCE
+LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Replaces the checks of loop accesses that sweep a contiguous range by
+// one __tsan_read_range or __tsan_write_range call in the preheader.
+// This applies to accesses of innermost loops in parallel code that run
+// in every iteration and whose address advances by exactly the access
+// size, when the trip count is known on entry. Loops that synchronize,
+// i.e. contain calls or atomics, are left alone, so the range is checked
+// with the same happens-before relation as the accesses it stands for.
+// For worksharing loops the preheader is the entry of the chunk.
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpander.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/InitializePasses.h"
+#include "llvm/Pass.h"
+#include "archer/LinkAllPasses.h"
+#include "archer/SafeAccess.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "archer-range"
+
+#define MIN_VERSION 39
+
+STATISTIC(NumCoalescedAccesses, "Number of loop accesses checked as ranges");
+STATISTIC(NumRangeChecks, "Number of range checks");
+
+namespace {
+
+struct CoalesceLoopAccesses : public FunctionPass {
+  CoalesceLoopAccesses() : FunctionPass(ID) { PassName = "CoalesceLoopAccesses"; }
+#if LLVM_VERSION > MIN_VERSION
+  StringRef getPassName() const override;
+#else
+  const char *getPassName() const override;
+#endif
+  void getAnalysisUsage(AnalysisUsage &AU) const override;
+  bool runOnFunction(Function &F) override;
+  bool doInitialization(Module &M) override;
+  static char ID;  // Pass identification, replacement for typeid.
+
+private:
+  std::string PassName;
+  Type *IntptrTy;
+  Function *TsanReadRange;
+  Function *TsanWriteRange;
+
+  bool coalesceLoop(Loop *L, ScalarEvolution &SE, DominatorTree &DT,
+                    const DataLayout &DL);
+};
+}  // namespace
+
+char CoalesceLoopAccesses::ID = 0;
+INITIALIZE_PASS_BEGIN(
+    CoalesceLoopAccesses, "archer-range",
+    "CoalesceLoopAccesses: check contiguous loop accesses as ranges.",
+    false, false)
+INITIALIZE_PASS_DEPENDENCY(DominatorTreeWrapperPass)
+INITIALIZE_PASS_DEPENDENCY(LoopInfoWrapperPass)
+INITIALIZE_PASS_DEPENDENCY(ScalarEvolutionWrapperPass)
+INITIALIZE_PASS_END(
+    CoalesceLoopAccesses, "archer-range",
+    "CoalesceLoopAccesses: check contiguous loop accesses as ranges.",
+    false, false)
+
+#if LLVM_VERSION > MIN_VERSION
+    StringRef CoalesceLoopAccesses::getPassName() const {
+        return PassName;
+    }
+#else
+    const char *CoalesceLoopAccesses::getPassName() const {
+        return PassName.c_str();
+    }
+#endif
+
+void CoalesceLoopAccesses::getAnalysisUsage(AnalysisUsage &AU) const {
+  AU.addRequired<DominatorTreeWrapperPass>();
+  AU.addRequired<LoopInfoWrapperPass>();
+  AU.addRequired<ScalarEvolutionWrapperPass>();
+  AU.setPreservesCFG();
+}
+
+Pass *llvm::createCoalesceLoopAccessesPass() {
+  return new CoalesceLoopAccesses();
+}
+
+bool CoalesceLoopAccesses::doInitialization(Module &M) {
+  IRBuilder<> IRB(M.getContext());
+  IntptrTy = M.getDataLayout().getIntPtrType(M.getContext());
+  FunctionType *RangeTy = FunctionType::get(
+      IRB.getVoidTy(), {IRB.getInt8PtrTy(), IntptrTy}, false);
+  TsanReadRange = getOrInsertArcherFunction(M, "__tsan_read_range", RangeTy);
+  TsanWriteRange = getOrInsertArcherFunction(M, "__tsan_write_range", RangeTy);
+  return true;
+}
+
+static bool isVtableAccess(Instruction *I) {
+  if (MDNode *Tag = I->getMetadata(LLVMContext::MD_tbaa))
+    return Tag->isTBAAVtableAccess();
+  return false;
+}
+
+bool CoalesceLoopAccesses::coalesceLoop(Loop *L, ScalarEvolution &SE,
+                                        DominatorTree &DT, const DataLayout &DL) {
+  BasicBlock *Preheader = L->getLoopPreheader();
+  BasicBlock *Latch = L->getLoopLatch();
+  // With the latch as the only exit, a block dominating the latch runs in
+  // every iteration, including the last one.
+  if (!Preheader || !Latch || L->getExitingBlock() != Latch)
+    return false;
+  const SCEV *BackedgeTakenCount = SE.getBackedgeTakenCount(L);
+  if (isa<SCEVCouldNotCompute>(BackedgeTakenCount))
+    return false;
+
+  SmallVector<std::pair<Instruction *, const SCEVAddRecExpr *>, 8> Candidates;
+  for (BasicBlock *BB : L->blocks()) {
+    for (auto &Inst : *BB) {
+      if (isa<CallInst>(Inst) || isa<InvokeInst>(Inst)) {
+        if (isa<DbgInfoIntrinsic>(Inst))
+          continue;
+        if (IntrinsicInst *II = dyn_cast<IntrinsicInst>(&Inst))
+          if (II->getIntrinsicID() == Intrinsic::lifetime_start ||
+              II->getIntrinsicID() == Intrinsic::lifetime_end)
+            continue;
+        if (isa<CallInst>(Inst) && cast<CallInst>(Inst).doesNotAccessMemory())
+          continue;
+        return false;
+      }
+      if (isa<AtomicRMWInst>(Inst) || isa<AtomicCmpXchgInst>(Inst) ||
+          isa<FenceInst>(Inst))
+        return false;
+
+      Value *Ptr;
+      Type *Ty;
+      if (LoadInst *Load = dyn_cast<LoadInst>(&Inst)) {
+        if (Load->isAtomic())
+          return false;
+        Ptr = Load->getPointerOperand();
+        Ty = Load->getType();
+      } else if (StoreInst *Store = dyn_cast<StoreInst>(&Inst)) {
+        if (Store->isAtomic())
+          return false;
+        Ptr = Store->getPointerOperand();
+        Ty = Store->getValueOperand()->getType();
+      } else {
+        continue;
+      }
+      if (isArcherSafeAccess(&Inst) || isVtableAccess(&Inst) ||
+          !DT.dominates(BB, Latch) || Ptr->getType()->getPointerAddressSpace() != 0)
+        continue;
+
+      const SCEVAddRecExpr *AR = dyn_cast<SCEVAddRecExpr>(SE.getSCEV(Ptr));
+      if (!AR || AR->getLoop() != L || !AR->isAffine() ||
+          !SE.isLoopInvariant(AR->getStart(), L))
+        continue;
+      const SCEVConstant *Step = dyn_cast<SCEVConstant>(AR->getStepRecurrence(SE));
+      int64_t Size = DL.getTypeStoreSize(Ty);
+      if (!Step || (Step->getValue()->getSExtValue() != Size &&
+                    Step->getValue()->getSExtValue() != -Size))
+        continue;
+      Candidates.push_back(std::make_pair(&Inst, AR));
+    }
+  }
+  if (Candidates.empty())
+    return false;
+
+  Instruction *InsertPt = Preheader->getTerminator();
+  IRBuilder<> IRB(InsertPt);
+  SCEVExpander Expander(SE, DL, "archer.range");
+  const SCEV *LastIteration = SE.getNoopOrZeroExtend(BackedgeTakenCount, IntptrTy);
+  const SCEV *Iterations =
+      SE.getAddExpr(LastIteration, SE.getConstant(IntptrTy, 1));
+
+  // One check per range; a write also covers reads of the same range.
+  typedef std::pair<const SCEV *, const SCEV *> Range;
+  SmallVector<Range, 8> Ranges;
+  DenseMap<Range, bool> IsWrite;
+  SmallVector<Instruction *, 8> Coalesced;
+  for (auto &Candidate : Candidates) {
+    const SCEVAddRecExpr *AR = Candidate.second;
+    int64_t Step = cast<SCEVConstant>(AR->getStepRecurrence(SE))->getValue()->getSExtValue();
+    const SCEV *Begin = AR->getStart();
+    if (Step < 0)
+      Begin = SE.getAddExpr(Begin, SE.getMulExpr(LastIteration,
+                                                 SE.getConstant(IntptrTy, Step, true)));
+    const SCEV *Length =
+        SE.getMulExpr(Iterations, SE.getConstant(IntptrTy, Step < 0 ? -Step : Step));
+    if (!isSafeToExpand(Begin, SE) || !isSafeToExpand(Length, SE))
+      continue;
+
+    Range R(Begin, Length);
+    auto It = IsWrite.find(R);
+    if (It == IsWrite.end()) {
+      Ranges.push_back(R);
+      IsWrite[R] = isa<StoreInst>(Candidate.first);
+    } else {
+      It->second |= isa<StoreInst>(Candidate.first);
+    }
+    Coalesced.push_back(Candidate.first);
+  }
+
+  for (const Range &R : Ranges) {
+    Value *Begin = Expander.expandCodeFor(R.first, IRB.getInt8PtrTy(), InsertPt);
+    Value *Length = Expander.expandCodeFor(R.second, IntptrTy, InsertPt);
+    IRB.SetInsertPoint(InsertPt);
+    IRB.CreateCall(IsWrite[R] ? TsanWriteRange : TsanReadRange, {Begin, Length});
+    ++NumRangeChecks;
+  }
+  for (Instruction *I : Coalesced)
+    markArcherSafeAccess(I, "range");
+  NumCoalescedAccesses += Coalesced.size();
+  return !Coalesced.empty();
+}
+
+bool CoalesceLoopAccesses::runOnFunction(Function &F) {
+  if (!F.hasFnAttribute(Attribute::SanitizeThread))
+    return false;
+
+  LoopInfo &LI = getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
+  ScalarEvolution &SE = getAnalysis<ScalarEvolutionWrapperPass>().getSE();
+  DominatorTree &DT = getAnalysis<DominatorTreeWrapperPass>().getDomTree();
+  const DataLayout &DL = F.getParent()->getDataLayout();
+
+  bool Changed = false;
+  SmallVector<Loop *, 8> Worklist(LI.begin(), LI.end());
+  while (!Worklist.empty()) {
+    Loop *L = Worklist.pop_back_val();
+    if (L->getSubLoops().empty())
+      Changed |= coalesceLoop(L, SE, DT, DL);
+    else
+      Worklist.append(L->begin(), L->end());
+  }
+  return Changed;
+}
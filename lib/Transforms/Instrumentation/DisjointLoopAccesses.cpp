@@ -0,0 +1,535 @@
+/*
+Copyright (c) 2015-2019, Lawrence Livermore National Security, LLC.
+
+Produced at the Lawrence Livermore National Laboratory
+
+Written by Simone Atzeni (simone@cs.utah.edu), Joachim Protze
+(joachim.protze@tu-dresden.de), Jonas Hahnfeld
+(hahnfeld@itc.rwth-aachen.de), Ganesh Gopalakrishnan, Zvonimir
+Rakamaric, Dong H. Ahn, Gregory L. Lee, Ignacio Laguna, and Martin
+Schulz.
+
+LLNL-CODE-773957
+
+All rights reserved.
+
+This file is part of Archer. For details, see
+https://pruners.github.io/archer. Please also read
+https://github.com/PRUNERS/archer/blob/master/LICENSE.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+   Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the disclaimer below.
+
+   Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the disclaimer (as noted below)
+   in the documentation and/or other materials provided with the
+   distribution.
+
+   Neither the name of the LLNS/LLNL nor the names of its contributors
+   may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LAWRENCE
+LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Proves that the accesses of a worksharing loop in an outlined parallel
+// region cannot race. The iterations of a worksharing loop are split
+// between the threads of the team, so an access whose address is affine
+// in the loop's induction variable, like the store in a[i] = b[i], only
+// races with accesses of other iterations to the same elements. Using
+// ScalarEvolution, an access is proven race free if no other iteration
+// writes what it touches and no other access in the region may write
+// the same object. A read of c[i-1] in a loop that writes c[i] stays
+// instrumented, as does everything in regions that call unknown code.
+//
+// Only addresses that follow the induction variable starting at the
+// thread's lower bound are split between the threads: a counter that
+// every thread starts at 0, as in g[j++], gives the same elements to all
+// of them.
+//
+// Iterations are only disjoint within one team. The accesses are
+// therefore marked in a clone of the outlined function, and the fork
+// call only uses the clone for regions that are not nested, i.e. when
+// omp_get_level() is 0 at the fork, and not forked by one of several
+// host teams, which libomp runs at the same level.
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/MemoryLocation.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Module.h"
+#include "llvm/InitializePasses.h"
+#include "llvm/Pass.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
+#include "archer/LinkAllPasses.h"
+#include "archer/SafeAccess.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "archer-disjoint"
+
+#define MIN_VERSION 39
+
+STATISTIC(NumDisjointAccesses, "Number of accesses of disjoint loop iterations");
+STATISTIC(NumDisjointRegions, "Number of outlined regions cloned for disjoint accesses");
+
+namespace {
+
+struct DisjointLoopAccesses : public ModulePass {
+  DisjointLoopAccesses() : ModulePass(ID) { PassName = "DisjointLoopAccesses"; }
+#if LLVM_VERSION > MIN_VERSION
+  StringRef getPassName() const override;
+#else
+  const char *getPassName() const override;
+#endif
+  void getAnalysisUsage(AnalysisUsage &AU) const override;
+  bool runOnModule(Module &M) override;
+  static char ID;  // Pass identification, replacement for typeid.
+
+private:
+  std::string PassName;
+
+  struct Access {
+    Instruction *Inst;
+    Value *Ptr;
+    bool IsWrite;
+    // Accesses that InstrumentMemoryAccesses does not handle, i.e. atomics,
+    // only constrain the others.
+    bool Markable;
+    uint64_t Size;
+    MemoryLocation Loc;
+    // The innermost worksharing loop containing the access and, if the
+    // address is affine in its induction variable, the address recurrence.
+    Loop *Worksharing;
+    const SCEVAddRecExpr *AddRec;
+  };
+
+  bool findDisjointAccesses(Function &F, SmallVectorImpl<Instruction *> &Disjoint);
+  bool conflicts(const Access &X, const Access &Y, ScalarEvolution &SE,
+                 AAResults &AA, const DataLayout &DL);
+  void forkDisjointClone(Function &F, Function &Clone);
+};
+}  // namespace
+
+char DisjointLoopAccesses::ID = 0;
+INITIALIZE_PASS_BEGIN(
+    DisjointLoopAccesses, "archer-disjoint",
+    "DisjointLoopAccesses: find disjoint accesses of worksharing loops.",
+    false, false)
+INITIALIZE_PASS_DEPENDENCY(AAResultsWrapperPass)
+INITIALIZE_PASS_DEPENDENCY(LoopInfoWrapperPass)
+INITIALIZE_PASS_DEPENDENCY(ScalarEvolutionWrapperPass)
+INITIALIZE_PASS_END(
+    DisjointLoopAccesses, "archer-disjoint",
+    "DisjointLoopAccesses: find disjoint accesses of worksharing loops.",
+    false, false)
+
+#if LLVM_VERSION > MIN_VERSION
+    StringRef DisjointLoopAccesses::getPassName() const {
+        return PassName;
+    }
+#else
+    const char *DisjointLoopAccesses::getPassName() const {
+        return PassName.c_str();
+    }
+#endif
+
+void DisjointLoopAccesses::getAnalysisUsage(AnalysisUsage &AU) const {
+  AU.addRequired<AAResultsWrapperPass>();
+  AU.addRequired<LoopInfoWrapperPass>();
+  AU.addRequired<ScalarEvolutionWrapperPass>();
+}
+
+Pass *llvm::createDisjointLoopAccessesPass() {
+  return new DisjointLoopAccesses();
+}
+
+// Runtime calls of a worksharing loop that do not touch user data.
+static bool isWorksharingRuntimeCall(StringRef Name) {
+  return Name == "__kmpc_for_static_fini" ||
+         Name.startswith("__kmpc_dispatch_fini_") ||
+         Name == "__kmpc_barrier" ||
+         Name == "__kmpc_global_thread_num" ||
+         Name == "__kmpc_reduce" || Name == "__kmpc_reduce_nowait" ||
+         Name == "__kmpc_end_reduce" || Name == "__kmpc_end_reduce_nowait" ||
+         Name == "__kmpc_critical" || Name == "__kmpc_end_critical" ||
+         Name == "omp_get_thread_num" || Name == "omp_get_num_threads";
+}
+
+// Returns whether S is computed from a load of one of the lower bounds
+// the runtime assigned to this thread, without looking into other
+// recurrences.
+static bool dependsOnLowerBound(const SCEV *S,
+                                const SmallPtrSetImpl<const Value *> &LowerBounds) {
+  if (const SCEVUnknown *U = dyn_cast<SCEVUnknown>(S)) {
+    if (const LoadInst *LD = dyn_cast<LoadInst>(U->getValue()))
+      return LowerBounds.count(LD->getPointerOperand()->stripPointerCasts());
+    return false;
+  }
+  if (const SCEVCastExpr *C = dyn_cast<SCEVCastExpr>(S))
+    return dependsOnLowerBound(C->getOperand(), LowerBounds);
+  if (const SCEVUDivExpr *D = dyn_cast<SCEVUDivExpr>(S))
+    return dependsOnLowerBound(D->getLHS(), LowerBounds) ||
+           dependsOnLowerBound(D->getRHS(), LowerBounds);
+  if (isa<SCEVAddRecExpr>(S))
+    return false;
+  if (const SCEVNAryExpr *N = dyn_cast<SCEVNAryExpr>(S)) {
+    for (const SCEV *Op : N->operands())
+      if (dependsOnLowerBound(Op, LowerBounds))
+        return true;
+  }
+  return false;
+}
+
+// A worksharing loop has an induction variable that starts at the lower
+// bound handed out by __kmpc_for_static_init or __kmpc_dispatch_next.
+// Returns its recurrence, or null if L is not a worksharing loop.
+static const SCEVAddRecExpr *
+getWorksharingInduction(Loop *L, ScalarEvolution &SE,
+                        const SmallPtrSetImpl<const Value *> &LowerBounds) {
+  for (auto &Inst : *L->getHeader()) {
+    PHINode *Phi = dyn_cast<PHINode>(&Inst);
+    if (!Phi)
+      break;
+    if (!SE.isSCEVable(Phi->getType()))
+      continue;
+    const SCEVAddRecExpr *AR = dyn_cast<SCEVAddRecExpr>(SE.getSCEV(Phi));
+    if (AR && AR->getLoop() == L && AR->isAffine() &&
+        isa<SCEVConstant>(AR->getStepRecurrence(SE)) &&
+        dependsOnLowerBound(AR->getStart(), LowerBounds))
+      return AR;
+  }
+  return nullptr;
+}
+
+static void collectWorksharingLoops(Loop *L, ScalarEvolution &SE,
+                                    const SmallPtrSetImpl<const Value *> &LowerBounds,
+                                    DenseMap<Loop *, const SCEVAddRecExpr *> &Worksharing) {
+  if (const SCEVAddRecExpr *IV = getWorksharingInduction(L, SE, LowerBounds))
+    Worksharing[L] = IV;
+  for (Loop *SubLoop : L->getSubLoops())
+    collectWorksharingLoops(SubLoop, SE, LowerBounds, Worksharing);
+}
+
+// Returns whether S has the same value in every thread of the team:
+// constants, the shared arguments of the microtask and values loaded
+// from them or from globals. The first two arguments are the thread ids.
+static bool isSameInAllThreads(const SCEV *S) {
+  if (isa<SCEVConstant>(S))
+    return true;
+  if (const SCEVUnknown *U = dyn_cast<SCEVUnknown>(S)) {
+    const Value *V = U->getValue();
+    if (const LoadInst *LD = dyn_cast<LoadInst>(V)) {
+      if (!LD->isSimple())
+        return false;
+      V = LD->getPointerOperand()->stripPointerCasts();
+    }
+    if (isa<Constant>(V))
+      return true;
+    if (const Argument *Arg = dyn_cast<Argument>(V))
+      return Arg->getArgNo() >= 2;
+    return false;
+  }
+  if (const SCEVCastExpr *C = dyn_cast<SCEVCastExpr>(S))
+    return isSameInAllThreads(C->getOperand());
+  if (const SCEVUDivExpr *D = dyn_cast<SCEVUDivExpr>(S))
+    return isSameInAllThreads(D->getLHS()) && isSameInAllThreads(D->getRHS());
+  if (isa<SCEVAddRecExpr>(S))
+    return false;
+  if (const SCEVNAryExpr *N = dyn_cast<SCEVNAryExpr>(S)) {
+    for (const SCEV *Op : N->operands())
+      if (!isSameInAllThreads(Op))
+        return false;
+    return true;
+  }
+  return false;
+}
+
+// Returns whether the address recurrence AR is Base + Scale * IV with a
+// base that is the same in every thread. Only then do the iterations
+// the runtime hands to different threads touch different addresses.
+static bool followsInduction(const SCEVAddRecExpr *AR, const SCEVAddRecExpr *IV,
+                             ScalarEvolution &SE) {
+  if (!AR->isAffine())
+    return false;
+  const SCEVConstant *Step = dyn_cast<SCEVConstant>(AR->getStepRecurrence(SE));
+  const SCEVConstant *IVStep = cast<SCEVConstant>(IV->getStepRecurrence(SE));
+  if (!Step || IVStep->getValue()->isZero())
+    return false;
+  int64_t StepVal = Step->getValue()->getSExtValue();
+  int64_t IVStepVal = IVStep->getValue()->getSExtValue();
+  if (StepVal % IVStepVal != 0)
+    return false;
+  Type *IntTy = SE.getEffectiveSCEVType(AR->getType());
+  const SCEV *Start = SE.getTruncateOrSignExtend(IV->getStart(), IntTy);
+  const SCEV *Scale = SE.getConstant(IntTy, StepVal / IVStepVal, true);
+  const SCEV *Base = SE.getMinusSCEV(AR->getStart(), SE.getMulExpr(Scale, Start));
+  return isSameInAllThreads(Base);
+}
+
+// Returns whether an access Dist bytes after another one with the same
+// step overlaps it in a different iteration, i.e. whether
+// -SizeY < Dist + Step * k < SizeX for some k != 0.
+static bool overlapsOtherIteration(int64_t Dist, int64_t Step, uint64_t SizeX,
+                                   uint64_t SizeY) {
+  if (Step == 0)
+    return true;
+  int64_t AbsStep = Step < 0 ? -Step : Step;
+  for (int64_t k = (-(int64_t)SizeY - Dist) / AbsStep - 1;
+       Dist + AbsStep * k < (int64_t)SizeX; ++k) {
+    if (k != 0 && Dist + AbsStep * k > -(int64_t)SizeY)
+      return true;
+  }
+  return false;
+}
+
+bool DisjointLoopAccesses::conflicts(const Access &X, const Access &Y,
+                                     ScalarEvolution &SE, AAResults &AA,
+                                     const DataLayout &DL) {
+  if (!X.IsWrite && !Y.IsWrite)
+    return false;
+
+  if (X.AddRec && Y.AddRec && X.Worksharing == Y.Worksharing) {
+    const SCEV *Dist = SE.getMinusSCEV(Y.AddRec, X.AddRec);
+    if (const SCEVConstant *C = dyn_cast<SCEVConstant>(Dist)) {
+      const SCEVConstant *StepX = cast<SCEVConstant>(X.AddRec->getStepRecurrence(SE));
+      const SCEVConstant *StepY = cast<SCEVConstant>(Y.AddRec->getStepRecurrence(SE));
+      if (StepX->getValue()->getSExtValue() != StepY->getValue()->getSExtValue())
+        return true;
+      return overlapsOtherIteration(C->getValue()->getSExtValue(),
+                                    StepX->getValue()->getSExtValue(),
+                                    X.Size, Y.Size);
+    }
+  }
+
+  // Otherwise the accesses must go to different objects.
+  SmallVector<Value *, 4> ObjectsX, ObjectsY;
+  GetUnderlyingObjects(X.Ptr, ObjectsX, DL);
+  GetUnderlyingObjects(Y.Ptr, ObjectsY, DL);
+  for (Value *ObjX : ObjectsX) {
+    for (Value *ObjY : ObjectsY) {
+      if (ObjX == ObjY)
+        return true;
+      if (isIdentifiedObject(ObjX) && isIdentifiedObject(ObjY))
+        continue;
+      MemoryLocation LocX(ObjX, MemoryLocation::UnknownSize, X.Loc.AATags);
+      MemoryLocation LocY(ObjY, MemoryLocation::UnknownSize, Y.Loc.AATags);
+      if (AA.alias(LocX, LocY) != AliasResult::NoAlias)
+        return true;
+    }
+  }
+  return false;
+}
+
+bool DisjointLoopAccesses::findDisjointAccesses(Function &F,
+                                                SmallVectorImpl<Instruction *> &Disjoint) {
+  LoopInfo &LI = getAnalysis<LoopInfoWrapperPass>(F).getLoopInfo();
+  ScalarEvolution &SE = getAnalysis<ScalarEvolutionWrapperPass>(F).getSE();
+  AAResults &AA = getAnalysis<AAResultsWrapperPass>(F).getAAResults();
+  const DataLayout &DL = F.getParent()->getDataLayout();
+
+  SmallPtrSet<const Value *, 4> LowerBounds;
+  SmallVector<Access, 32> Accesses;
+  auto addAccess = [&](Instruction *I, Value *Ptr, bool IsWrite, bool Markable,
+                       uint64_t Size, const MemoryLocation &Loc) {
+    Access A = {I, Ptr, IsWrite, Markable, Size, Loc, nullptr, nullptr};
+    Accesses.push_back(A);
+  };
+
+  for (auto &BB : F) {
+    for (auto &Inst : BB) {
+      if (isArcherSafeAccess(&Inst))
+        continue;
+      if (LoadInst *Load = dyn_cast<LoadInst>(&Inst)) {
+        addAccess(Load, Load->getPointerOperand(), false, !Load->isAtomic(),
+                  DL.getTypeStoreSize(Load->getType()), MemoryLocation::get(Load));
+      } else if (StoreInst *SI = dyn_cast<StoreInst>(&Inst)) {
+        addAccess(SI, SI->getPointerOperand(), true, !SI->isAtomic(),
+                  DL.getTypeStoreSize(SI->getValueOperand()->getType()),
+                  MemoryLocation::get(SI));
+      } else if (AtomicRMWInst *RMW = dyn_cast<AtomicRMWInst>(&Inst)) {
+        addAccess(RMW, RMW->getPointerOperand(), true, false, 0,
+                  MemoryLocation::get(RMW));
+      } else if (AtomicCmpXchgInst *CX = dyn_cast<AtomicCmpXchgInst>(&Inst)) {
+        addAccess(CX, CX->getPointerOperand(), true, false, 0,
+                  MemoryLocation::get(CX));
+      } else if (MemTransferInst *MT = dyn_cast<MemTransferInst>(&Inst)) {
+        addAccess(MT, MT->getRawDest(), true, true, 0,
+                  MemoryLocation::getForDest(MT));
+        addAccess(MT, MT->getRawSource(), false, true, 0,
+                  MemoryLocation::getForSource(MT));
+      } else if (MemSetInst *MS = dyn_cast<MemSetInst>(&Inst)) {
+        addAccess(MS, MS->getRawDest(), true, true, 0,
+                  MemoryLocation::getForDest(MS));
+      } else if (isa<InvokeInst>(Inst)) {
+        return false;
+      } else if (CallInst *CI = dyn_cast<CallInst>(&Inst)) {
+        if (isa<DbgInfoIntrinsic>(CI) || CI->doesNotAccessMemory() ||
+            isArcherSerialDispatch(*CI))
+          continue;
+        if (IntrinsicInst *II = dyn_cast<IntrinsicInst>(CI)) {
+          if (II->getIntrinsicID() == Intrinsic::lifetime_start ||
+              II->getIntrinsicID() == Intrinsic::lifetime_end)
+            continue;
+        }
+        Function *Callee = CI->getCalledFunction();
+        if (!Callee)
+          return false;
+        StringRef Name = Callee->getName();
+        if (Name.startswith("__kmpc_for_static_init_")) {
+          // A worksharing loop inside another loop of the region may run
+          // concurrently with its next instance.
+          if (LI.getLoopFor(&BB))
+            return false;
+          LowerBounds.insert(CI->getArgOperand(4)->stripPointerCasts());
+        } else if (Name.startswith("__kmpc_dispatch_init_")) {
+          if (LI.getLoopFor(&BB))
+            return false;
+        } else if (Name.startswith("__kmpc_dispatch_next_")) {
+          LowerBounds.insert(CI->getArgOperand(3)->stripPointerCasts());
+        } else if (!isWorksharingRuntimeCall(Name)) {
+          return false;
+        }
+      }
+    }
+  }
+  if (LowerBounds.empty())
+    return false;
+
+  DenseMap<Loop *, const SCEVAddRecExpr *> WorksharingLoops;
+  for (Loop *L : LI)
+    collectWorksharingLoops(L, SE, LowerBounds, WorksharingLoops);
+  if (WorksharingLoops.empty())
+    return false;
+
+  for (Access &A : Accesses) {
+    for (Loop *L = LI.getLoopFor(A.Inst->getParent()); L; L = L->getParentLoop()) {
+      if (WorksharingLoops.count(L)) {
+        A.Worksharing = L;
+        break;
+      }
+    }
+    if (!A.Worksharing || A.Size == 0 || !SE.isSCEVable(A.Ptr->getType()))
+      continue;
+    const SCEVAddRecExpr *AR = dyn_cast<SCEVAddRecExpr>(SE.getSCEV(A.Ptr));
+    if (AR && AR->getLoop() == A.Worksharing &&
+        followsInduction(AR, WorksharingLoops[A.Worksharing], SE))
+      A.AddRec = AR;
+  }
+
+  // An instruction is race free if none of its accesses conflicts with
+  // any access of the region, including itself in other iterations.
+  DenseMap<Instruction *, bool> RaceFree;
+  for (const Access &X : Accesses) {
+    bool Safe = X.Markable && X.Worksharing;
+    for (const Access &Y : Accesses) {
+      if (!Safe)
+        break;
+      Safe = !conflicts(X, Y, SE, AA, DL);
+    }
+    auto It = RaceFree.find(X.Inst);
+    if (It == RaceFree.end())
+      RaceFree[X.Inst] = Safe;
+    else
+      It->second &= Safe;
+  }
+  for (const Access &X : Accesses) {
+    auto It = RaceFree.find(X.Inst);
+    if (It != RaceFree.end() && It->second) {
+      Disjoint.push_back(X.Inst);
+      RaceFree.erase(It);
+    }
+  }
+  return !Disjoint.empty();
+}
+
+// Lets every fork of F that is neither nested nor inside a league of
+// several teams run Clone instead.
+void DisjointLoopAccesses::forkDisjointClone(Function &F, Function &Clone) {
+  Module &M = *F.getParent();
+  IRBuilder<> IRB(M.getContext());
+  Function *OmpGetLevel = getOrInsertArcherFunction(
+      M, "omp_get_level", FunctionType::get(IRB.getInt32Ty(), false));
+  Function *OmpGetNumTeams = getOrInsertArcherFunction(
+      M, "omp_get_num_teams", FunctionType::get(IRB.getInt32Ty(), false));
+
+  SmallVector<CallInst *, 4> Forks;
+  for (const Use &U : F.uses())
+    if (CallInst *CI = getForkCallOfMicrotask(U))
+      if (CI->getCalledFunction()->getName() == "__kmpc_fork_call")
+        Forks.push_back(CI);
+
+  for (CallInst *CI : Forks) {
+    IRB.SetInsertPoint(CI);
+    Value *Microtask = CI->getArgOperand(2);
+    Value *Level = IRB.CreateCall(OmpGetLevel, {}, "archer.level");
+    Value *NumTeams = IRB.CreateCall(OmpGetNumTeams, {}, "archer.num_teams");
+    Value *NotNested = IRB.CreateAnd(IRB.CreateICmpEQ(Level, IRB.getInt32(0)),
+                                     IRB.CreateICmpEQ(NumTeams, IRB.getInt32(1)));
+    Value *DisjointMicrotask = IRB.CreateSelect(
+        NotNested, ConstantExpr::getBitCast(&Clone, Microtask->getType()),
+        Microtask, "archer.microtask");
+    CI->setArgOperand(2, DisjointMicrotask);
+  }
+}
+
+bool DisjointLoopAccesses::runOnModule(Module &M) {
+  SmallVector<Function *, 8> Microtasks;
+  for (auto &F : M) {
+    if (F.isDeclaration() || !F.hasFnAttribute(Attribute::SanitizeThread) ||
+        !isOpenMPOutlinedFunction(F))
+      continue;
+    for (const Use &U : F.uses()) {
+      CallInst *Fork = getForkCallOfMicrotask(U);
+      if (Fork && Fork->getCalledFunction()->getName() == "__kmpc_fork_call") {
+        Microtasks.push_back(&F);
+        break;
+      }
+    }
+  }
+
+  bool Changed = false;
+  for (Function *F : Microtasks) {
+    SmallVector<Instruction *, 16> Disjoint;
+    if (!findDisjointAccesses(*F, Disjoint))
+      continue;
+
+    ValueToValueMapTy VMap;
+    Function *Clone = CloneFunction(F, VMap);
+    Clone->setName(F->getName() + "__archer_disjoint__");
+    for (Instruction *I : Disjoint)
+      markArcherSafeAccess(cast<Instruction>(VMap[I]), "disjoint");
+    forkDisjointClone(*F, *Clone);
+    NumDisjointAccesses += Disjoint.size();
+    ++NumDisjointRegions;
+    Changed = true;
+  }
+  return Changed;
+}
@@ -0,0 +1,545 @@
+/*
+Copyright (c) 2015-2019, Lawrence Livermore National Security, LLC.
+
+Produced at the Lawrence Livermore National Laboratory
+
+Written by Simone Atzeni (simone@cs.utah.edu), Joachim Protze
+(joachim.protze@tu-dresden.de), Jonas Hahnfeld
+(hahnfeld@itc.rwth-aachen.de), Ganesh Gopalakrishnan, Zvonimir
+Rakamaric, Dong H. Ahn, Gregory L. Lee, Ignacio Laguna, and Martin
+Schulz.
+
+LLNL-CODE-773957
+
+All rights reserved.
+
+This file is part of Archer. For details, see
+https://pruners.github.io/archer. Please also read
+https://github.com/PRUNERS/archer/blob/master/LICENSE.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+   Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the disclaimer below.
+
+   Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the disclaimer (as noted below)
+   in the documentation and/or other materials provided with the
+   distribution.
+
+   Neither the name of the LLNS/LLNL nor the names of its contributors
+   may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LAWRENCE
+LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Instruments the memory accesses of functions that contain accesses
+// marked with archer.safe metadata. ThreadSanitizer has no way to skip
+// individual accesses, so for those functions this pass removes the
+// SanitizeThread attribute and emits the __tsan_read/__tsan_write calls
+// for the remaining accesses itself, the same way ThreadSanitizer would.
+// Atomic accesses and function entry/exit are still instrumented by
+// ThreadSanitizer, which runs right after this pass.
+//
+// With -archer-profile-gen the pass instruments all functions and counts
+// each instrumented access in the runtime (see rtl/sites.h). A rebuild
+// with -archer-profile-use=<file> drops the hot accesses that the
+// profile shows only touched data of a single thread.
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Analysis/CaptureTracking.h"
+#if LLVM_VERSION >= 60
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#endif
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Type.h"
+#include "llvm/InitializePasses.h"
+#include "llvm/Pass.h"
+#include "llvm/ProfileData/InstrProf.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/LineIterator.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "archer/LinkAllPasses.h"
+#include "archer/SafeAccess.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "archer-tsan"
+
+#define MIN_VERSION 39
+
+STATISTIC(NumInstrumentedReads, "Number of instrumented reads");
+STATISTIC(NumInstrumentedWrites, "Number of instrumented writes");
+STATISTIC(NumInstrumentedMemIntrinsics, "Number of instrumented memory intrinsics");
+STATISTIC(NumProfileDropped, "Number of hot single-thread accesses dropped by the profile");
+
+static const size_t kNumberOfAccessSizes = 5;
+
+static cl::opt<bool> ClProfileGen(
+    "archer-profile-gen",
+    cl::desc("Count the executions of instrumented accesses"),
+    cl::Hidden, cl::init(false));
+static cl::opt<std::string> ClProfileUse(
+    "archer-profile-use",
+    cl::desc("Drop hot single-thread accesses listed in this profile"),
+    cl::Hidden, cl::init(""));
+static cl::opt<unsigned> ClProfileHot(
+    "archer-profile-hot",
+    cl::desc("Percentage of the profiled executions that count as hot"),
+    cl::Hidden, cl::init(90));
+
+namespace {
+
+struct InstrumentMemoryAccesses : public FunctionPass {
+  InstrumentMemoryAccesses() : FunctionPass(ID) { PassName = "InstrumentMemoryAccesses"; }
+#if LLVM_VERSION > MIN_VERSION
+  StringRef getPassName() const override;
+#else
+  const char *getPassName() const override;
+#endif
+  void getAnalysisUsage(AnalysisUsage &AU) const override;
+  bool runOnFunction(Function &F) override;
+  bool doInitialization(Module &M) override;
+  static char ID;  // Pass identification, replacement for typeid.
+
+private:
+  std::string PassName;
+  Type *IntptrTy;
+  Function *TsanRead[kNumberOfAccessSizes];
+  Function *TsanWrite[kNumberOfAccessSizes];
+  Function *TsanUnalignedRead[kNumberOfAccessSizes];
+  Function *TsanUnalignedWrite[kNumberOfAccessSizes];
+  Function *TsanVptrUpdate;
+  Function *TsanVptrLoad;
+  Function *MemmoveFn, *MemcpyFn, *MemsetFn;
+  Function *ArcherProfileAccess;
+  StructType *SiteTy;
+  Constant *ModuleName;
+  // Accesses dropped by the profile, keyed like the profile lines.
+  StringSet<> DroppedSites;
+
+  void readProfile();
+  std::string getSiteKey(Function &F, unsigned Ordinal);
+  void instrumentProfile(Instruction *I, Constant *FunctionName,
+                         unsigned Ordinal, const DataLayout &DL);
+
+  void chooseInstructionsToInstrument(SmallVectorImpl<Instruction *> &Local,
+                                      SmallVectorImpl<Instruction *> &All,
+                                      const DataLayout &DL);
+  bool instrumentLoadOrStore(Instruction *I, const DataLayout &DL);
+  bool instrumentMemIntrinsic(Instruction *I);
+};
+}  // namespace
+
+char InstrumentMemoryAccesses::ID = 0;
+INITIALIZE_PASS_BEGIN(
+    InstrumentMemoryAccesses, "archer-tsan",
+    "InstrumentMemoryAccesses: instrument accesses not proven race free.",
+    false, false)
+#if LLVM_VERSION >= 60
+INITIALIZE_PASS_DEPENDENCY(OptimizationRemarkEmitterWrapperPass)
+#endif
+INITIALIZE_PASS_END(
+    InstrumentMemoryAccesses, "archer-tsan",
+    "InstrumentMemoryAccesses: instrument accesses not proven race free.",
+    false, false)
+
+#if LLVM_VERSION > MIN_VERSION
+    StringRef InstrumentMemoryAccesses::getPassName() const {
+        return PassName;
+    }
+#else
+    const char *InstrumentMemoryAccesses::getPassName() const {
+        return PassName.c_str();
+    }
+#endif
+
+void InstrumentMemoryAccesses::getAnalysisUsage(AnalysisUsage &AU) const {
+  AU.setPreservesCFG();
+#if LLVM_VERSION >= 60
+  AU.addRequired<OptimizationRemarkEmitterWrapperPass>();
+#endif
+}
+
+Pass *llvm::createInstrumentMemoryAccessesPass() {
+  return new InstrumentMemoryAccesses();
+}
+
+static Constant *createStringConstant(Module &M, StringRef Str) {
+  Constant *Init = ConstantDataArray::getString(M.getContext(), Str, true);
+  GlobalVariable *GV = new GlobalVariable(M, Init->getType(), true,
+                                          GlobalValue::PrivateLinkage, Init,
+                                          "__archer_site_name");
+  GV->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+  return ConstantExpr::getPointerCast(GV, Type::getInt8PtrTy(M.getContext()));
+}
+
+bool InstrumentMemoryAccesses::doInitialization(Module &M) {
+  LLVMContext &C = M.getContext();
+  IRBuilder<> IRB(C);
+  IntptrTy = M.getDataLayout().getIntPtrType(C);
+  Type *VoidTy = IRB.getVoidTy();
+  Type *PtrTy = IRB.getInt8PtrTy();
+
+  FunctionType *AccessTy = FunctionType::get(VoidTy, {PtrTy}, false);
+  for (size_t i = 0; i < kNumberOfAccessSizes; ++i) {
+    std::string ByteSizeStr = utostr(1U << i);
+    TsanRead[i] = getOrInsertArcherFunction(M, "__tsan_read" + ByteSizeStr, AccessTy);
+    TsanWrite[i] = getOrInsertArcherFunction(M, "__tsan_write" + ByteSizeStr, AccessTy);
+    TsanUnalignedRead[i] = getOrInsertArcherFunction(M, "__tsan_unaligned_read" + ByteSizeStr, AccessTy);
+    TsanUnalignedWrite[i] = getOrInsertArcherFunction(M, "__tsan_unaligned_write" + ByteSizeStr, AccessTy);
+  }
+  TsanVptrUpdate = getOrInsertArcherFunction(M, "__tsan_vptr_update",
+                                             FunctionType::get(VoidTy, {PtrTy, PtrTy}, false));
+  TsanVptrLoad = getOrInsertArcherFunction(M, "__tsan_vptr_read", AccessTy);
+  MemmoveFn = getOrInsertArcherFunction(M, "memmove",
+                                        FunctionType::get(PtrTy, {PtrTy, PtrTy, IntptrTy}, false));
+  MemcpyFn = getOrInsertArcherFunction(M, "memcpy",
+                                       FunctionType::get(PtrTy, {PtrTy, PtrTy, IntptrTy}, false));
+  MemsetFn = getOrInsertArcherFunction(M, "memset",
+                                       FunctionType::get(PtrTy, {PtrTy, IRB.getInt32Ty(), IntptrTy}, false));
+
+  if (ClProfileGen) {
+    ArcherProfileAccess = getOrInsertArcherFunction(
+        M, "__archer_profile_access",
+        FunctionType::get(VoidTy, {PtrTy, PtrTy, IRB.getInt64Ty()}, false));
+    SiteTy = StructType::get(PtrTy, PtrTy, IRB.getInt64Ty());
+    ModuleName = createStringConstant(M, M.getModuleIdentifier());
+  }
+  DroppedSites.clear();
+  if (!ClProfileUse.empty())
+    readProfile();
+  return true;
+}
+
+std::string InstrumentMemoryAccesses::getSiteKey(Function &F, unsigned Ordinal) {
+  return (Twine(F.getParent()->getModuleIdentifier()) + "\t" + F.getName() +
+          "\t" + Twine(Ordinal)).str();
+}
+
+// Reads the merged lines "module function ordinal count single" of one
+// or more runs. The hottest sites that make up ClProfileHot percent of
+// all executions are dropped if every run saw them touch only data of a
+// single thread.
+void InstrumentMemoryAccesses::readProfile() {
+  ErrorOr<std::unique_ptr<MemoryBuffer>> Buffer =
+      MemoryBuffer::getFile(ClProfileUse);
+  if (!Buffer)
+    report_fatal_error(Twine("Cannot read Archer profile ") + ClProfileUse);
+
+  StringMap<std::pair<uint64_t, bool>> Sites;
+  uint64_t Total = 0;
+  for (line_iterator Line(**Buffer); !Line.is_at_end(); ++Line) {
+    SmallVector<StringRef, 5> Fields;
+    Line->split(Fields, '\t');
+    uint64_t Count;
+    if (Fields.size() != 5 || Fields[3].getAsInteger(10, Count))
+      report_fatal_error(Twine("Malformed Archer profile ") + ClProfileUse);
+    std::pair<uint64_t, bool> &Site = Sites[(Fields[0] + "\t" + Fields[1] + "\t" + Fields[2]).str()];
+    if (Site.first == 0)
+      Site.second = true;
+    Site.first += Count;
+    Site.second &= Fields[4] == "1";
+    Total += Count;
+  }
+
+  std::vector<StringMapEntry<std::pair<uint64_t, bool>> *> Hottest;
+  for (auto &Site : Sites)
+    Hottest.push_back(&Site);
+  std::sort(Hottest.begin(), Hottest.end(),
+            [](StringMapEntry<std::pair<uint64_t, bool>> *A,
+               StringMapEntry<std::pair<uint64_t, bool>> *B) {
+              return A->getValue().first > B->getValue().first;
+            });
+  uint64_t Hot = 0;
+  for (auto *Site : Hottest) {
+    if (Hot * 100 >= Total * ClProfileHot)
+      break;
+    Hot += Site->getValue().first;
+    if (Site->getValue().second)
+      DroppedSites.insert(Site->getKey());
+  }
+}
+
+static bool isVtableAccess(Instruction *I) {
+  if (MDNode *Tag = I->getMetadata(LLVMContext::MD_tbaa))
+    return Tag->isTBAAVtableAccess();
+  return false;
+}
+
+// Do not instrument known races/"benign races" that come from compiler
+// instrumentation and accesses to other address spaces.
+static bool shouldInstrumentReadWriteFromAddress(Value *Addr) {
+  Value *Base = Addr->stripInBoundsOffsets();
+  if (GlobalVariable *GV = dyn_cast<GlobalVariable>(Base)) {
+    StringRef Name = GV->getName();
+    if (Name.startswith(getInstrProfCountersVarPrefix()) ||
+        Name.startswith("__llvm_gcov") || Name.startswith("__llvm_gcda"))
+      return false;
+  }
+  return Addr->getType()->getPointerAddressSpace() == 0;
+}
+
+static bool addrPointsToConstantData(Value *Addr) {
+  if (GetElementPtrInst *GEP = dyn_cast<GetElementPtrInst>(Addr))
+    Addr = GEP->getPointerOperand();
+  if (GlobalVariable *GV = dyn_cast<GlobalVariable>(Addr))
+    return GV->isConstant();
+  if (LoadInst *L = dyn_cast<LoadInst>(Addr))
+    return isVtableAccess(L);
+  return false;
+}
+
+// Same selection as ThreadSanitizer: reads that are followed by a write
+// to the same address in the same block without an intervening call,
+// reads of constant data and accesses to allocas that are not captured
+// are not instrumented.
+void InstrumentMemoryAccesses::chooseInstructionsToInstrument(
+    SmallVectorImpl<Instruction *> &Local, SmallVectorImpl<Instruction *> &All,
+    const DataLayout &DL) {
+  SmallPtrSet<Value *, 8> WriteTargets;
+  for (size_t i = Local.size(); i > 0; --i) {
+    Instruction *I = Local[i - 1];
+    Value *Addr;
+    if (StoreInst *Store = dyn_cast<StoreInst>(I)) {
+      Addr = Store->getPointerOperand();
+      if (!shouldInstrumentReadWriteFromAddress(Addr))
+        continue;
+      WriteTargets.insert(Addr);
+    } else {
+      Addr = cast<LoadInst>(I)->getPointerOperand();
+      if (!shouldInstrumentReadWriteFromAddress(Addr))
+        continue;
+      if (WriteTargets.count(Addr))
+        continue;
+      if (addrPointsToConstantData(Addr))
+        continue;
+    }
+    if (isa<AllocaInst>(GetUnderlyingObject(Addr, DL)) &&
+        !PointerMayBeCaptured(Addr, true, true))
+      continue;
+    All.push_back(I);
+  }
+  Local.clear();
+}
+
+static int getMemoryAccessFuncIndex(Type *OrigTy, const DataLayout &DL) {
+  if (!OrigTy->isSized())
+    return -1;
+  uint32_t TypeSize = DL.getTypeStoreSizeInBits(OrigTy);
+  if (TypeSize != 8 && TypeSize != 16 && TypeSize != 32 && TypeSize != 64 &&
+      TypeSize != 128)
+    return -1;
+  return countTrailingZeros(TypeSize / 8);
+}
+
+bool InstrumentMemoryAccesses::instrumentLoadOrStore(Instruction *I,
+                                                     const DataLayout &DL) {
+  IRBuilder<> IRB(I);
+  bool IsWrite = isa<StoreInst>(*I);
+  Value *Addr = IsWrite ? cast<StoreInst>(I)->getPointerOperand()
+                        : cast<LoadInst>(I)->getPointerOperand();
+  Type *OrigTy = IsWrite ? cast<StoreInst>(I)->getValueOperand()->getType()
+                         : I->getType();
+  int Idx = getMemoryAccessFuncIndex(OrigTy, DL);
+  if (Idx < 0)
+    return false;
+
+  if (isVtableAccess(I)) {
+    if (IsWrite) {
+      Value *StoredValue = cast<StoreInst>(I)->getValueOperand();
+      // Storing several vptrs at once; the first one is enough to find
+      // vptr races.
+      if (isa<VectorType>(StoredValue->getType()))
+        StoredValue = IRB.CreateExtractElement(
+            StoredValue, ConstantInt::get(IRB.getInt32Ty(), 0));
+      if (StoredValue->getType()->isIntegerTy())
+        StoredValue = IRB.CreateIntToPtr(StoredValue, IRB.getInt8PtrTy());
+      IRB.CreateCall(TsanVptrUpdate,
+                     {IRB.CreatePointerCast(Addr, IRB.getInt8PtrTy()),
+                      IRB.CreatePointerCast(StoredValue, IRB.getInt8PtrTy())});
+    } else {
+      IRB.CreateCall(TsanVptrLoad,
+                     IRB.CreatePointerCast(Addr, IRB.getInt8PtrTy()));
+    }
+    return true;
+  }
+
+  const unsigned Alignment = IsWrite ? cast<StoreInst>(I)->getAlignment()
+                                     : cast<LoadInst>(I)->getAlignment();
+  const uint32_t TypeSize = DL.getTypeStoreSizeInBits(OrigTy);
+  Function *OnAccessFunc;
+  if (Alignment == 0 || Alignment >= 8 || (Alignment % (TypeSize / 8)) == 0)
+    OnAccessFunc = IsWrite ? TsanWrite[Idx] : TsanRead[Idx];
+  else
+    OnAccessFunc = IsWrite ? TsanUnalignedWrite[Idx] : TsanUnalignedRead[Idx];
+  IRB.CreateCall(OnAccessFunc, IRB.CreatePointerCast(Addr, IRB.getInt8PtrTy()));
+  return true;
+}
+
+// Passes the access and a constant describing it to the runtime, which
+// counts the executions and tracks the address range of each thread.
+void InstrumentMemoryAccesses::instrumentProfile(Instruction *I,
+                                                 Constant *FunctionName,
+                                                 unsigned Ordinal,
+                                                 const DataLayout &DL) {
+  IRBuilder<> IRB(I);
+  bool IsWrite = isa<StoreInst>(*I);
+  Value *Addr = IsWrite ? cast<StoreInst>(I)->getPointerOperand()
+                        : cast<LoadInst>(I)->getPointerOperand();
+  Type *OrigTy = IsWrite ? cast<StoreInst>(I)->getValueOperand()->getType()
+                         : I->getType();
+  Constant *Site = ConstantStruct::get(
+      SiteTy, {ModuleName, FunctionName, IRB.getInt64(Ordinal)});
+  GlobalVariable *GV = new GlobalVariable(*I->getModule(), SiteTy, true,
+                                          GlobalValue::PrivateLinkage, Site,
+                                          "__archer_site");
+  IRB.CreateCall(ArcherProfileAccess,
+                 {IRB.CreatePointerCast(GV, IRB.getInt8PtrTy()),
+                  IRB.CreatePointerCast(Addr, IRB.getInt8PtrTy()),
+                  IRB.getInt64(DL.getTypeStoreSize(OrigTy))});
+}
+
+// Memory intrinsics are replaced by calls to the libc functions, which
+// the ThreadSanitizer runtime intercepts.
+bool InstrumentMemoryAccesses::instrumentMemIntrinsic(Instruction *I) {
+  IRBuilder<> IRB(I);
+  if (MemSetInst *M = dyn_cast<MemSetInst>(I)) {
+    IRB.CreateCall(MemsetFn,
+                   {IRB.CreatePointerCast(M->getArgOperand(0), IRB.getInt8PtrTy()),
+                    IRB.CreateIntCast(M->getArgOperand(1), IRB.getInt32Ty(), false),
+                    IRB.CreateIntCast(M->getArgOperand(2), IntptrTy, false)});
+    I->eraseFromParent();
+    return true;
+  } else if (MemTransferInst *M = dyn_cast<MemTransferInst>(I)) {
+    IRB.CreateCall(isa<MemCpyInst>(M) ? MemcpyFn : MemmoveFn,
+                   {IRB.CreatePointerCast(M->getArgOperand(0), IRB.getInt8PtrTy()),
+                    IRB.CreatePointerCast(M->getArgOperand(1), IRB.getInt8PtrTy()),
+                    IRB.CreateIntCast(M->getArgOperand(2), IntptrTy, false)});
+    I->eraseFromParent();
+    return true;
+  }
+  return false;
+}
+
+bool InstrumentMemoryAccesses::runOnFunction(Function &F) {
+  if (!F.hasFnAttribute(Attribute::SanitizeThread))
+    return false;
+
+  const DataLayout &DL = F.getParent()->getDataLayout();
+  SmallVector<Instruction *, 8> AllLoadsAndStores;
+  SmallVector<Instruction *, 8> LocalLoadsAndStores;
+  SmallVector<Instruction *, 8> MemIntrinCalls;
+  DenseMap<Instruction *, unsigned> Ordinals;
+  SmallVector<Instruction *, 8> SafeAccesses;
+  unsigned NumAccesses = 0;
+  bool HasSafeAccesses = false;
+
+  for (auto &BB : F) {
+    for (auto &Inst : BB) {
+      if (isa<LoadInst>(Inst) || isa<StoreInst>(Inst)) {
+        bool IsAtomic = isa<LoadInst>(Inst) ? cast<LoadInst>(Inst).isAtomic()
+                                            : cast<StoreInst>(Inst).isAtomic();
+        if (IsAtomic)
+          continue;
+        unsigned Ordinal = NumAccesses++;
+        if (!DroppedSites.empty() && !isArcherSafeAccess(&Inst) &&
+            DroppedSites.count(getSiteKey(F, Ordinal))) {
+          markArcherSafeAccess(&Inst, "profile");
+          ++NumProfileDropped;
+        }
+        if (isArcherSafeAccess(&Inst)) {
+          SafeAccesses.push_back(&Inst);
+          HasSafeAccesses = true;
+          continue;
+        }
+        Ordinals[&Inst] = Ordinal;
+        LocalLoadsAndStores.push_back(&Inst);
+      } else if (isa<CallInst>(Inst) || isa<InvokeInst>(Inst)) {
+        if (isa<MemIntrinsic>(Inst)) {
+          if (isArcherSafeAccess(&Inst)) {
+            SafeAccesses.push_back(&Inst);
+            HasSafeAccesses = true;
+          } else {
+            MemIntrinCalls.push_back(&Inst);
+          }
+        }
+        chooseInstructionsToInstrument(LocalLoadsAndStores, AllLoadsAndStores, DL);
+      }
+    }
+    chooseInstructionsToInstrument(LocalLoadsAndStores, AllLoadsAndStores, DL);
+  }
+
+  // Either this pass or ThreadSanitizer instruments the selected accesses.
+  for (auto Inst : AllLoadsAndStores) {
+    if (isa<StoreInst>(Inst))
+      ++NumInstrumentedWrites;
+    else
+      ++NumInstrumentedReads;
+  }
+  NumInstrumentedMemIntrinsics += MemIntrinCalls.size();
+#if LLVM_VERSION >= 60
+  OptimizationRemarkEmitter &ORE =
+      getAnalysis<OptimizationRemarkEmitterWrapperPass>().getORE();
+  for (auto Inst : SafeAccesses)
+    ORE.emit([&]() {
+      return OptimizationRemark("archer", "NotInstrumented", Inst)
+             << "access not instrumented ("
+             << ore::NV("Reason", getArcherSafeAccessReason(Inst)) << ")";
+    });
+  for (auto Inst : AllLoadsAndStores)
+    ORE.emit([&]() {
+      return OptimizationRemarkMissed("archer", "Instrumented", Inst)
+             << "access instrumented";
+    });
+  for (auto Inst : MemIntrinCalls)
+    ORE.emit([&]() {
+      return OptimizationRemarkMissed("archer", "Instrumented", Inst)
+             << "memory intrinsic instrumented";
+    });
+#endif
+
+  // Leave functions without proven accesses to ThreadSanitizer.
+  if (!HasSafeAccesses && !ClProfileGen)
+    return false;
+
+  F.removeFnAttr(Attribute::SanitizeThread);
+  Constant *FunctionName =
+      ClProfileGen ? createStringConstant(*F.getParent(), F.getName()) : nullptr;
+  for (auto Inst : AllLoadsAndStores)
+    if (instrumentLoadOrStore(Inst, DL) && ClProfileGen)
+      instrumentProfile(Inst, FunctionName, Ordinals[Inst], DL);
+  for (auto Inst : MemIntrinCalls)
+    instrumentMemIntrinsic(Inst);
+  return true;
+}
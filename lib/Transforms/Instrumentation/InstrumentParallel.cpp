@@ -48,12 +48,17 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
 #include "llvm/Transforms/Instrumentation.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/SmallSet.h"
 #include "llvm/ADT/SmallString.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/Statistic.h"
 #include "llvm/ADT/StringExtras.h"
 #include "llvm/Analysis/CaptureTracking.h"
+#if LLVM_VERSION >= 60
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#endif
 #include "llvm/Analysis/TargetLibraryInfo.h"
 #include "llvm/Analysis/ValueTracking.h"
 #include "llvm/IR/DataLayout.h"
@@ -66,6 +71,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "llvm/IR/Metadata.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Type.h"
+#include "llvm/InitializePasses.h"
 #include "llvm/ProfileData/InstrProf.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"
@@ -80,11 +86,19 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "llvm/Transforms/Utils/ModuleUtils.h"
 #include "llvm/Transforms/Utils/ValueMapper.h"
 #include "archer/LinkAllPasses.h"
+#include "archer/SafeAccess.h"
 
 using namespace llvm;
 
+#define DEBUG_TYPE "archer-sbl"
+
 #define MIN_VERSION 39
 
+STATISTIC(NumClonedFunctions, "Number of functions cloned for parallel code");
+STATISTIC(NumSerialFunctions, "Number of functions only called serially");
+STATISTIC(NumParallelCalls, "Number of calls redirected to parallel clones");
+STATISTIC(NumSerialRegions, "Number of outlined regions with an uninstrumented copy");
+
 namespace {
 
 struct InstrumentParallel : public FunctionPass {
@@ -101,6 +115,14 @@ struct InstrumentParallel : public FunctionPass {
 
 private:
   std::string PassName;
+  // Functions that may be called from a parallel region.
+  SmallPtrSet<Function *, 32> ParallelFunctions;
+  // Parallel clone of each function that got one.
+  DenseMap<Function *, Function *> ParallelClones;
+  // Microtasks forked with __kmpc_fork_call or __kmpc_fork_teams and the
+  // outlined functions they call, which get an uninstrumented copy.
+  SmallPtrSet<Function *, 16> SerialRegions;
+  void callParallelClone(Instruction &Inst);
   void setMetadata(Instruction *Inst, const char *name, const char *description);
 };
 }  // namespace
@@ -110,6 +132,9 @@ INITIALIZE_PASS_BEGIN(
     InstrumentParallel, "archer-sbl",
     "InstrumentParallel: instrument parallel functions.",
     false, false)
+#if LLVM_VERSION >= 60
+INITIALIZE_PASS_DEPENDENCY(OptimizationRemarkEmitterWrapperPass)
+#endif
 INITIALIZE_PASS_END(
     InstrumentParallel, "archer-sbl",
     "InstrumentParallel: instrument parallel functions.",
@@ -126,16 +151,133 @@ INITIALIZE_PASS_END(
 #endif
 
 void InstrumentParallel::getAnalysisUsage(AnalysisUsage &AU) const {
+#if LLVM_VERSION >= 60
+  AU.addRequired<OptimizationRemarkEmitterWrapperPass>();
+#endif
 }
 
 Pass *llvm::createInstrumentParallelPass() {
   return new InstrumentParallel();
 }
 
+static Function *getDirectCallee(Instruction &Inst) {
+  Value *Callee = nullptr;
+  if (CallInst *CI = dyn_cast<CallInst>(&Inst))
+    Callee = CI->getCalledValue();
+  else if (InvokeInst *II = dyn_cast<InvokeInst>(&Inst))
+    Callee = II->getCalledValue();
+  return Callee ? dyn_cast<Function>(Callee->stripPointerCasts()) : nullptr;
+}
+
+// clang gives outlined regions their own sanitizer attributes, so a
+// region inside a function excluded with no_sanitize("thread") or a fun:
+// entry of the ignore file would still be instrumented. Regions, task
+// entries and helpers referenced by excluded code are excluded as well.
+static void excludeRegionsOfExcludedFunctions(Module &M) {
+  SmallVector<Function *, 16> Worklist;
+  for (auto &F : M)
+    if (!F.isDeclaration() && !F.hasFnAttribute(Attribute::SanitizeThread))
+      Worklist.push_back(&F);
+  while (!Worklist.empty()) {
+    Function *F = Worklist.pop_back_val();
+    for (auto &BB : *F) {
+      for (auto &Inst : BB) {
+        for (Value *Op : Inst.operands()) {
+          Function *Region = dyn_cast<Function>(Op->stripPointerCasts());
+          if (!Region || Region->isDeclaration() ||
+              !Region->getName().startswith(".omp") ||
+              !Region->hasFnAttribute(Attribute::SanitizeThread))
+            continue;
+          Region->removeFnAttr(Attribute::SanitizeThread);
+          Worklist.push_back(Region);
+        }
+      }
+    }
+  }
+}
+
 bool InstrumentParallel::doInitialization(Module &M) {
+  excludeRegionsOfExcludedFunctions(M);
+
+  // Outlined regions run in parallel. Functions visible outside of this
+  // module or whose address is taken may be called from parallel code we
+  // cannot see, everything they call directly may run in parallel too.
+  SmallVector<Function *, 16> Worklist;
+  ParallelFunctions.clear();
+  ParallelClones.clear();
+  SerialRegions.clear();
+  // Task entries, reduction functions and the like may run while another
+  // thread runs the same region, only forked microtasks can run alone.
+  for (auto &F : M) {
+    if (F.isDeclaration() || !F.getName().startswith(".omp"))
+      continue;
+    for (const Use &U : F.uses()) {
+      if (getForkCallOfMicrotask(U)) {
+        SerialRegions.insert(&F);
+        Worklist.push_back(&F);
+        break;
+      }
+    }
+  }
+  while (!Worklist.empty()) {
+    Function *F = Worklist.pop_back_val();
+    for (auto &BB : *F) {
+      for (auto &Inst : BB) {
+        Function *Callee = getDirectCallee(Inst);
+        if (Callee && !Callee->isDeclaration() &&
+            Callee->getName().startswith(".omp") &&
+            SerialRegions.insert(Callee).second)
+          Worklist.push_back(Callee);
+      }
+    }
+  }
+  for (auto &F : M) {
+    if (F.isDeclaration() || F.getName() == "main")
+      continue;
+    if (F.getName().startswith(".omp") || !F.hasLocalLinkage() ||
+        F.hasAddressTaken()) {
+      ParallelFunctions.insert(&F);
+      Worklist.push_back(&F);
+    }
+  }
+  while (!Worklist.empty()) {
+    Function *F = Worklist.pop_back_val();
+    for (auto &BB : *F) {
+      for (auto &Inst : BB) {
+        Function *Callee = getDirectCallee(Inst);
+        if (Callee && !Callee->isDeclaration() &&
+            ParallelFunctions.insert(Callee).second)
+          Worklist.push_back(Callee);
+      }
+    }
+  }
   return true;
 }
 
+static bool isParallelCode(const Function &F) {
+  if (F.getName().endswith("__archer_st__"))
+    return false;
+  return F.getName().startswith(".omp") || F.getName().endswith("__archer__");
+}
+
+// Code in parallel regions calls the parallel clones directly, so only
+// functions entered from serial code check __archer_status__.
+void InstrumentParallel::callParallelClone(Instruction &Inst) {
+  Function *Callee = getDirectCallee(Inst);
+  if (!Callee || !ParallelClones.count(Callee))
+    return;
+  if (CallInst *CI = dyn_cast<CallInst>(&Inst)) {
+    if (CI->getCalledValue() != Callee)
+      return;
+    CI->setCalledFunction(ParallelClones[Callee]);
+  } else if (InvokeInst *II = dyn_cast<InvokeInst>(&Inst)) {
+    if (II->getCalledValue() != Callee)
+      return;
+    II->setCalledFunction(ParallelClones[Callee]);
+  }
+  ++NumParallelCalls;
+}
+
 void InstrumentParallel::setMetadata(Instruction *Inst, const char *name, const char *description) {
   LLVMContext& C = Inst->getContext();
   MDNode* N = MDNode::get(C, MDString::get(C, description));
@@ -144,6 +286,10 @@ void InstrumentParallel::setMetadata(Instruction *Inst, const char *name, const
 
 bool InstrumentParallel::runOnFunction(Function &F) {
   llvm::GlobalVariable *ompStatusGlobal = NULL;
+#if LLVM_VERSION >= 60
+  OptimizationRemarkEmitter &ORE =
+      getAnalysis<OptimizationRemarkEmitterWrapperPass>().getORE();
+#endif
   Module *M = F.getParent();
   StringRef functionName = F.getName();
 
@@ -158,7 +304,7 @@ bool InstrumentParallel::runOnFunction(Function &F) {
         new llvm::GlobalVariable(*M, Int32Ty, false,
                                  llvm::GlobalValue::CommonLinkage,
                                  Zero, "__archer_status__", NULL,
-                                 GlobalVariable::GeneralDynamicTLSModel,
+                                 GlobalVariable::LocalExecTLSModel,
                                  0, false);
     } else if(ompStatusGlobal &&
               (ompStatusGlobal->getLinkage() != llvm::GlobalValue::CommonLinkage)) {
@@ -166,6 +312,9 @@ bool InstrumentParallel::runOnFunction(Function &F) {
       ompStatusGlobal->setExternallyInitialized(false);
       ompStatusGlobal->setInitializer(Zero);
     }
+    // main is linked into the executable, which places the status in the
+    // static TLS block: every module can use the exec TLS models.
+    ompStatusGlobal->setThreadLocalMode(GlobalVariable::LocalExecTLSModel);
 
 #if !LIBOMP_TSAN_SUPPORT
     // Add function for Tsan suppressions
@@ -230,6 +379,7 @@ bool InstrumentParallel::runOnFunction(Function &F) {
 
   if(functionName.endswith("_dtor") ||
      functionName.endswith("__archer__") ||
+     functionName.endswith("__archer_st__") ||
      functionName.endswith("__clang_call_terminate") ||
      functionName.endswith("__tsan_default_suppressions") ||
      functionName.endswith("__archer_get_omp_status") ||
@@ -237,19 +387,95 @@ bool InstrumentParallel::runOnFunction(Function &F) {
     return true;
   }
 
+  // Functions excluded from checking with no_sanitize("thread"), e.g.
+  // through archer_no_check or the ignore file, get neither a clone nor
+  // a check of __archer_status__.
+  if(!functionName.startswith(".omp") &&
+     !F.hasFnAttribute(llvm::Attribute::SanitizeThread)) {
+    return false;
+  }
+
   if(!ompStatusGlobal) {
     IntegerType *Int32Ty = IntegerType::getInt32Ty(M->getContext());
     ompStatusGlobal =
       new llvm::GlobalVariable(*M, Int32Ty, false,
                                llvm::GlobalValue::AvailableExternallyLinkage,
                                0, "__archer_status__", NULL,
-                               GlobalVariable::GeneralDynamicTLSModel,
+                               GlobalVariable::InitialExecTLSModel,
                                0, true);
   }
 
   if(functionName.startswith(".omp")) {
+    // Regions excluded from checking need no uninstrumented copy.
+    BasicBlock *parallelBB = &F.getEntryBlock();
+    if (F.hasFnAttribute(llvm::Attribute::SanitizeThread) &&
+        SerialRegions.count(&F)) {
+      // A region that runs while no parallel region is active, e.g. with a
+      // team of one thread, cannot race: it runs an uninstrumented copy
+      // that calls the serial versions of all functions. libomp does not
+      // raise the level for a league of host teams, so there must also be
+      // a single team.
+      ValueToValueMapTy VMap;
+      Function *serialFunction = CloneFunction(&F, VMap);
+      serialFunction->setName(functionName + "__archer_st__");
+      serialFunction->removeFnAttr(llvm::Attribute::SanitizeThread);
+      ++NumSerialRegions;
+#if LLVM_VERSION >= 60
+      ORE.emit([&]() {
+        return OptimizationRemark("archer", "SerialRegion", F.getSubprogram(), &F.getEntryBlock())
+               << "uninstrumented copy for regions without an active parallel region";
+      });
+#endif
+
+      // Keep the allocas in the entry block and check the active level
+      // after them.
+      BasicBlock::iterator firstEntryBBI = F.getEntryBlock().begin();
+      while (isa<AllocaInst>(firstEntryBBI))
+        ++firstEntryBBI;
+      Instruction *firstEntryBBDI = NULL;
+      for (auto &Inst : F.getEntryBlock()) {
+        if(Inst.getDebugLoc()) {
+          firstEntryBBDI = &Inst;
+          break;
+        }
+      }
+      Function *ompGetActiveLevel = getOrInsertArcherFunction(
+          *M, "omp_get_active_level",
+          FunctionType::get(Type::getInt32Ty(M->getContext()), false));
+      Function *ompGetNumTeams = getOrInsertArcherFunction(
+          *M, "omp_get_num_teams",
+          FunctionType::get(Type::getInt32Ty(M->getContext()), false));
+      CallInst *activeLevel = CallInst::Create(ompGetActiveLevel, "activeLevel", &*firstEntryBBI);
+      CallInst *numTeams = CallInst::Create(ompGetNumTeams, "numTeams", &*firstEntryBBI);
+      Instruction *notActive = new ICmpInst(&*firstEntryBBI, ICmpInst::ICMP_EQ, activeLevel, Zero, "__archer__st.inactive");
+      Instruction *oneTeam = new ICmpInst(&*firstEntryBBI, ICmpInst::ICMP_EQ, numTeams, One, "__archer__st.oneteam");
+      Instruction *serialCond = BinaryOperator::Create(BinaryOperator::And, notActive, oneTeam, "__archer__st.cond", &*firstEntryBBI);
+      parallelBB = F.getEntryBlock().splitBasicBlock(firstEntryBBI, "__archer__parallel");
+      F.getEntryBlock().back().eraseFromParent();
+      BasicBlock *serialBB = BasicBlock::Create(M->getContext(), "__archer__st", &F, parallelBB);
+      BranchInst::Create(serialBB, parallelBB, serialCond, &F.getEntryBlock());
+
+      std::vector<Value*> args;
+      for (auto &Arg : F.args())
+        args.push_back(&Arg);
+      CallInst *serialCall = CallInst::Create(serialFunction, args, "", serialBB);
+      if (firstEntryBBDI) {
+        activeLevel->setDebugLoc(firstEntryBBDI->getDebugLoc());
+        numTeams->setDebugLoc(firstEntryBBDI->getDebugLoc());
+        serialCall->setDebugLoc(firstEntryBBDI->getDebugLoc());
+      }
+      ReturnInst::Create(M->getContext(),
+                         F.getReturnType()->isVoidTy() ? nullptr : serialCall,
+                         serialBB);
+    }
+
+    for (auto &BB : F)
+      for (auto &Inst : BB)
+        callParallelClone(Inst);
+
+
     // Increment of __archer_status__
-    Instruction *entryBBI = &F.getEntryBlock().front();
+    Instruction *entryBBI = &parallelBB->front();
     LoadInst *loadInc = new LoadInst(ompStatusGlobal, "loadIncOmpStatus", false, entryBBI);
     loadInc->setAlignment(4);
     setMetadata(loadInc, "archer.ompstatus", "ArcherRT Instrumentation");
@@ -278,10 +504,40 @@ bool InstrumentParallel::runOnFunction(Function &F) {
     } else {
       report_fatal_error("Broken function found, compilation aborted!");
     }
+  } else if(!ParallelFunctions.count(&F)) {
+    // Internal functions only called outside of parallel regions need
+    // neither a clone nor a check of __archer_status__.
+    F.removeFnAttr(llvm::Attribute::SanitizeThread);
+    ++NumSerialFunctions;
+#if LLVM_VERSION >= 60
+    ORE.emit([&]() {
+      return OptimizationRemark("archer", "NotCloned", F.getSubprogram(), &F.getEntryBlock())
+             << ore::NV("Function", &F) << " not instrumented, only called outside of parallel regions";
+    });
+#endif
   } else {
     ValueToValueMapTy VMap;
     Function *new_function = CloneFunction(&F, VMap);
     new_function->setName(functionName + "__archer__");
+    ParallelClones[&F] = new_function;
+    ++NumClonedFunctions;
+#if LLVM_VERSION >= 60
+    ORE.emit([&]() {
+      return OptimizationRemarkMissed("archer", "Cloned", F.getSubprogram(), &F.getEntryBlock())
+             << ore::NV("Function", &F) << " cloned for calls from parallel regions";
+    });
+#endif
+    // Redirect calls in the clone and in parallel code seen so far.
+    for (auto &BB : *new_function)
+      for (auto &Inst : BB)
+        callParallelClone(Inst);
+    SmallVector<Instruction *, 8> ParallelCalls;
+    for (User *U : F.users())
+      if (Instruction *Inst = dyn_cast<Instruction>(U))
+        if (isParallelCode(*Inst->getParent()->getParent()))
+          ParallelCalls.push_back(Inst);
+    for (Instruction *Inst : ParallelCalls)
+      callParallelClone(*Inst);
     Function::arg_iterator it = F.arg_begin();
     Function::arg_iterator end = F.arg_end();
     std::vector<Value*> args;
@@ -0,0 +1,327 @@
+/*
+Copyright (c) 2015-2019, Lawrence Livermore National Security, LLC.
+
+Produced at the Lawrence Livermore National Laboratory
+
+Written by Simone Atzeni (simone@cs.utah.edu), Joachim Protze
+(joachim.protze@tu-dresden.de), Jonas Hahnfeld
+(hahnfeld@itc.rwth-aachen.de), Ganesh Gopalakrishnan, Zvonimir
+Rakamaric, Dong H. Ahn, Gregory L. Lee, Ignacio Laguna, and Martin
+Schulz.
+
+LLNL-CODE-773957
+
+All rights reserved.
+
+This file is part of Archer. For details, see
+https://pruners.github.io/archer. Please also read
+https://github.com/PRUNERS/archer/blob/master/LICENSE.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+   Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the disclaimer below.
+
+   Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the disclaimer (as noted below)
+   in the documentation and/or other materials provided with the
+   distribution.
+
+   Neither the name of the LLNS/LLNL nor the names of its contributors
+   may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LAWRENCE
+LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Finds memory that parallel code only reads and marks the loads of it,
+// so ThreadSanitizer does not check them. Parallel code is every
+// function that is still instrumented after InstrumentParallel, i.e. the
+// outlined regions and the __archer__ clones. Read-only memory is:
+//
+//  - globals with internal linkage whose address does not escape and
+//    that are not written by parallel code, e.g. lookup tables filled
+//    before the first parallel region;
+//  - local variables shared with a parallel region that the region only
+//    reads and that are not shared with anything else.
+//
+// Writes from serial code are ordered with the reads by the fork and
+// join of the regions.
+
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Pass.h"
+#include "archer/LinkAllPasses.h"
+#include "archer/SafeAccess.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "archer-readonly"
+
+#define MIN_VERSION 39
+
+STATISTIC(NumReadOnlyAccesses, "Number of reads of data parallel code never writes");
+
+namespace {
+
+struct ReadOnlySharedData : public ModulePass {
+  ReadOnlySharedData() : ModulePass(ID) { PassName = "ReadOnlySharedData"; }
+#if LLVM_VERSION > MIN_VERSION
+  StringRef getPassName() const override;
+#else
+  const char *getPassName() const override;
+#endif
+  void getAnalysisUsage(AnalysisUsage &AU) const override;
+  bool runOnModule(Module &M) override;
+  static char ID;  // Pass identification, replacement for typeid.
+
+private:
+  std::string PassName;
+  SmallPtrSet<const Value *, 16> ReadOnly;
+
+  bool isReadOnlyObject(Value *Ptr, const DataLayout &DL);
+  bool isReadOnlySharedLocal(const AllocaInst *AI) const;
+  void collectReadOnlyParams(Function &Microtask);
+};
+}  // namespace
+
+char ReadOnlySharedData::ID = 0;
+INITIALIZE_PASS_BEGIN(
+    ReadOnlySharedData, "archer-readonly",
+    "ReadOnlySharedData: find data that parallel code only reads.",
+    false, false)
+INITIALIZE_PASS_END(
+    ReadOnlySharedData, "archer-readonly",
+    "ReadOnlySharedData: find data that parallel code only reads.",
+    false, false)
+
+#if LLVM_VERSION > MIN_VERSION
+    StringRef ReadOnlySharedData::getPassName() const {
+        return PassName;
+    }
+#else
+    const char *ReadOnlySharedData::getPassName() const {
+        return PassName.c_str();
+    }
+#endif
+
+void ReadOnlySharedData::getAnalysisUsage(AnalysisUsage &AU) const {
+  AU.setPreservesAll();
+}
+
+Pass *llvm::createReadOnlySharedDataPass() {
+  return new ReadOnlySharedData();
+}
+
+static bool isParallelCode(const Function *F) {
+  return F->hasFnAttribute(Attribute::SanitizeThread);
+}
+
+// A call that cannot write memory and does not keep the pointer.
+static bool isReadOnlyCallArgument(const CallInst *CI, unsigned ArgNo) {
+  if (isa<DbgInfoIntrinsic>(CI))
+    return true;
+  if (const IntrinsicInst *II = dyn_cast<IntrinsicInst>(CI))
+    if (II->getIntrinsicID() == Intrinsic::lifetime_start ||
+        II->getIntrinsicID() == Intrinsic::lifetime_end)
+      return true;
+  return CI->onlyReadsMemory() && CI->doesNotCapture(ArgNo);
+}
+
+// Walks the uses of Root. Writes from functions for which WriteAllowed
+// returns true are accepted; any other write or escape of the address
+// makes the memory not read-only. Shared, if given, collects the fork
+// and microtask calls Root is passed to as a shared variable.
+template <typename WriteAllowedTy>
+static bool onlyReadBy(const Value *Root, WriteAllowedTy WriteAllowed,
+                       SmallVectorImpl<const Use *> *Shared) {
+  SmallVector<const Value *, 16> Worklist;
+  SmallPtrSet<const Value *, 16> Visited;
+  Worklist.push_back(Root);
+  Visited.insert(Root);
+  while (!Worklist.empty()) {
+    const Value *V = Worklist.pop_back_val();
+    for (const Use &U : V->uses()) {
+      const User *Usr = U.getUser();
+      if (const ConstantExpr *CE = dyn_cast<ConstantExpr>(Usr)) {
+        if (CE->getOpcode() != Instruction::GetElementPtr &&
+            CE->getOpcode() != Instruction::BitCast &&
+            CE->getOpcode() != Instruction::AddrSpaceCast)
+          return false;
+        if (Visited.insert(CE).second)
+          Worklist.push_back(CE);
+        continue;
+      }
+      const Instruction *I = dyn_cast<Instruction>(Usr);
+      if (!I)
+        return false;
+      const Function *F = I->getParent()->getParent();
+      if (isa<LoadInst>(I) || isa<ICmpInst>(I))
+        continue;
+      if (const StoreInst *SI = dyn_cast<StoreInst>(I)) {
+        if (SI->getValueOperand() == V || !WriteAllowed(F))
+          return false;
+        continue;
+      }
+      if (isa<AtomicRMWInst>(I) || isa<AtomicCmpXchgInst>(I)) {
+        if (U.getOperandNo() != 0 || !WriteAllowed(F))
+          return false;
+        continue;
+      }
+      if (isa<GetElementPtrInst>(I) || isa<BitCastInst>(I) ||
+          isa<AddrSpaceCastInst>(I) || isa<PHINode>(I) || isa<SelectInst>(I)) {
+        if (Visited.insert(I).second)
+          Worklist.push_back(I);
+        continue;
+      }
+      if (isa<MemIntrinsic>(I)) {
+        if (U.getOperandNo() == 0 && !WriteAllowed(F))
+          return false;
+        continue;
+      }
+      if (const CallInst *CI = dyn_cast<CallInst>(I)) {
+        // The uninstrumented copy of a region runs the same code alone.
+        if (isArcherSerialDispatch(*CI))
+          continue;
+        if (U.getOperandNo() < CI->getNumArgOperands() &&
+            isReadOnlyCallArgument(CI, U.getOperandNo()))
+          continue;
+        const Function *Callee = CI->getCalledFunction();
+        if (Shared && Callee && V == Root &&
+            U.getOperandNo() < CI->getNumArgOperands() &&
+            ((isForkCall(Callee) && U.getOperandNo() > 2) ||
+             (isOpenMPOutlinedFunction(*Callee) && Callee->hasLocalLinkage()))) {
+          Shared->push_back(&U);
+          continue;
+        }
+      }
+      return false;
+    }
+  }
+  return true;
+}
+
+// A local variable shared with parallel regions is read-only if only its
+// owner writes it, which happens before the fork or after the join.
+bool ReadOnlySharedData::isReadOnlySharedLocal(const AllocaInst *AI) const {
+  SmallVector<const Use *, 4> Shared;
+  const Function *Owner = AI->getParent()->getParent();
+  if (!onlyReadBy(AI, [Owner](const Function *F) { return F == Owner; }, &Shared))
+    return false;
+  return !Shared.empty();
+}
+
+bool ReadOnlySharedData::isReadOnlyObject(Value *Ptr, const DataLayout &DL) {
+  SmallVector<Value *, 4> Objects;
+  GetUnderlyingObjects(Ptr, Objects, DL);
+  if (Objects.empty())
+    return false;
+  for (Value *Obj : Objects) {
+    if (ReadOnly.count(Obj))
+      continue;
+    const AllocaInst *AI = dyn_cast<AllocaInst>(Obj);
+    if (!AI || !isReadOnlySharedLocal(AI))
+      return false;
+  }
+  return true;
+}
+
+// Shared variables arrive as the parameters after global_tid and
+// bound_tid. A parameter is read-only if every fork and direct call
+// passes read-only memory and the region does not write through it.
+void ReadOnlySharedData::collectReadOnlyParams(Function &Microtask) {
+  const DataLayout &DL = Microtask.getParent()->getDataLayout();
+  for (auto &Param : Microtask.args()) {
+    unsigned ArgNo = Param.getArgNo();
+    if (ArgNo < 2 || !Param.getType()->isPointerTy())
+      continue;
+    bool IsReadOnly = true;
+    for (const Use &U : Microtask.uses()) {
+      Value *Actual = nullptr;
+      if (CallInst *Fork = getForkCallOfMicrotask(U)) {
+        if (ArgNo + 1 < Fork->getNumArgOperands())
+          Actual = Fork->getArgOperand(ArgNo + 1);
+      } else if (CallInst *CI = dyn_cast<CallInst>(U.getUser())) {
+        if (CI->getCalledValue() == &Microtask)
+          Actual = CI->getArgOperand(ArgNo);
+      }
+      if (!Actual || !isReadOnlyObject(Actual, DL)) {
+        IsReadOnly = false;
+        break;
+      }
+    }
+    if (IsReadOnly &&
+        onlyReadBy(&Param, [](const Function *) { return false; }, nullptr))
+      ReadOnly.insert(&Param);
+  }
+}
+
+bool ReadOnlySharedData::runOnModule(Module &M) {
+  ReadOnly.clear();
+  const DataLayout &DL = M.getDataLayout();
+
+  for (auto &GV : M.globals()) {
+    if (GV.isConstant() || !GV.hasLocalLinkage() || GV.isThreadLocal())
+      continue;
+    if (onlyReadBy(&GV, [](const Function *F) { return !isParallelCode(F); },
+                   nullptr))
+      ReadOnly.insert(&GV);
+  }
+
+  for (auto &F : M) {
+    if (F.isDeclaration() || !F.hasLocalLinkage())
+      continue;
+    for (const Use &U : F.uses()) {
+      if (getForkCallOfMicrotask(U)) {
+        collectReadOnlyParams(F);
+        break;
+      }
+    }
+  }
+
+  bool Changed = false;
+  for (auto &F : M) {
+    if (F.isDeclaration() || !isParallelCode(&F))
+      continue;
+    for (auto &BB : F) {
+      for (auto &Inst : BB) {
+        LoadInst *LI = dyn_cast<LoadInst>(&Inst);
+        if (!LI || LI->isAtomic() || isArcherSafeAccess(LI))
+          continue;
+        SmallVector<Value *, 4> Objects;
+        GetUnderlyingObjects(LI->getPointerOperand(), Objects, DL);
+        bool IsReadOnly = !Objects.empty();
+        for (Value *Obj : Objects)
+          IsReadOnly &= ReadOnly.count(Obj) != 0;
+        if (!IsReadOnly)
+          continue;
+        markArcherSafeAccess(LI, "readonly");
+        ++NumReadOnlyAccesses;
+        Changed = true;
+      }
+    }
+  }
+  return Changed;
+}
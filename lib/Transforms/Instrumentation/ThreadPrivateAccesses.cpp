@@ -0,0 +1,385 @@
+/*
+Copyright (c) 2015-2019, Lawrence Livermore National Security, LLC.
+
+Produced at the Lawrence Livermore National Laboratory
+
+Written by Simone Atzeni (simone@cs.utah.edu), Joachim Protze
+(joachim.protze@tu-dresden.de), Jonas Hahnfeld
+(hahnfeld@itc.rwth-aachen.de), Ganesh Gopalakrishnan, Zvonimir
+Rakamaric, Dong H. Ahn, Gregory L. Lee, Ignacio Laguna, and Martin
+Schulz.
+
+LLNL-CODE-773957
+
+All rights reserved.
+
+This file is part of Archer. For details, see
+https://pruners.github.io/archer. Please also read
+https://github.com/PRUNERS/archer/blob/master/LICENSE.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+   Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the disclaimer below.
+
+   Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the disclaimer (as noted below)
+   in the documentation and/or other materials provided with the
+   distribution.
+
+   Neither the name of the LLNS/LLNL nor the names of its contributors
+   may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LAWRENCE
+LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Proves that loads and stores in functions instrumented by
+// ThreadSanitizer only touch memory that no other thread can reach, and
+// marks them with archer.safe metadata. Thread-private memory is:
+//
+//  - allocas whose address does not escape, which covers private,
+//    firstprivate and lastprivate copies as well as loop-local
+//    temporaries of an outlined region;
+//  - the global_tid and bound_tid arguments the runtime passes to the
+//    microtasks of __kmpc_fork_call and __kmpc_fork_teams;
+//  - pointer arguments of internal functions whose call sites only ever
+//    pass thread-private memory.
+//
+// The arguments are computed as an optimistic fixpoint over the module,
+// so private pointers can be followed through chains of internal helper
+// functions.
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/CaptureTracking.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Pass.h"
+#include "archer/LinkAllPasses.h"
+#include "archer/SafeAccess.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "archer-private"
+
+#define MIN_VERSION 39
+
+STATISTIC(NumPrivateAccesses, "Number of accesses to thread-private memory");
+
+namespace {
+
+struct ThreadPrivateAccesses : public ModulePass {
+  ThreadPrivateAccesses() : ModulePass(ID) { PassName = "ThreadPrivateAccesses"; }
+#if LLVM_VERSION > MIN_VERSION
+  StringRef getPassName() const override;
+#else
+  const char *getPassName() const override;
+#endif
+  void getAnalysisUsage(AnalysisUsage &AU) const override;
+  bool runOnModule(Module &M) override;
+  static char ID;  // Pass identification, replacement for typeid.
+
+private:
+  std::string PassName;
+  // Arguments that only ever point to thread-private memory.
+  SmallPtrSet<const Argument *, 16> PrivateArgs;
+  // Number of leading arguments of each microtask that the runtime
+  // points to thread-private storage.
+  DenseMap<const Function *, unsigned> Microtasks;
+  DenseMap<const Value *, bool> EscapeCache;
+
+  void collectMicrotasks(Module &M);
+  bool isCandidate(const Function &F) const;
+  bool isPrivateArgument(const Argument *A);
+  bool isPrivatePointer(Value *Ptr, const DataLayout &DL);
+  bool escapes(const Value *Root);
+  bool callKeepsPrivate(const CallInst *CI, unsigned ArgNo) const;
+  bool markPrivateAccesses(Function &F);
+};
+}  // namespace
+
+char ThreadPrivateAccesses::ID = 0;
+INITIALIZE_PASS_BEGIN(
+    ThreadPrivateAccesses, "archer-private",
+    "ThreadPrivateAccesses: find accesses to thread-private memory.",
+    false, false)
+INITIALIZE_PASS_END(
+    ThreadPrivateAccesses, "archer-private",
+    "ThreadPrivateAccesses: find accesses to thread-private memory.",
+    false, false)
+
+#if LLVM_VERSION > MIN_VERSION
+    StringRef ThreadPrivateAccesses::getPassName() const {
+        return PassName;
+    }
+#else
+    const char *ThreadPrivateAccesses::getPassName() const {
+        return PassName.c_str();
+    }
+#endif
+
+void ThreadPrivateAccesses::getAnalysisUsage(AnalysisUsage &AU) const {
+  AU.setPreservesAll();
+}
+
+Pass *llvm::createThreadPrivateAccessesPass() {
+  return new ThreadPrivateAccesses();
+}
+
+// Runtime entry points that only write their pointer arguments on behalf
+// of the calling thread (loop bounds, strides and the last iteration
+// flag of worksharing loops).
+static bool isThreadLocalRuntimeCall(StringRef Name) {
+  return Name.startswith("__kmpc_for_static_init_") ||
+         Name.startswith("__kmpc_dist_for_static_init_") ||
+         Name.startswith("__kmpc_team_static_init_") ||
+         Name.startswith("__kmpc_dispatch_next_");
+}
+
+void ThreadPrivateAccesses::collectMicrotasks(Module &M) {
+  for (auto &F : M) {
+    if (F.isDeclaration())
+      continue;
+    for (const Use &U : F.uses()) {
+      if (getForkCallOfMicrotask(U)) {
+        Microtasks[&F] = 2;
+        break;
+      }
+    }
+  }
+}
+
+// Only functions whose every caller is visible can have their arguments
+// proven private.
+bool ThreadPrivateAccesses::isCandidate(const Function &F) const {
+  if (F.isDeclaration() || !F.hasLocalLinkage())
+    return false;
+  for (const Use &U : F.uses()) {
+    const CallInst *CI = dyn_cast<CallInst>(U.getUser());
+    if (CI && CI->getCalledValue() == &F)
+      continue;
+    if (Microtasks.count(&F) && getForkCallOfMicrotask(U))
+      continue;
+    return false;
+  }
+  return true;
+}
+
+bool ThreadPrivateAccesses::callKeepsPrivate(const CallInst *CI,
+                                             unsigned ArgNo) const {
+  if (isa<DbgInfoIntrinsic>(CI))
+    return true;
+  if (CI->doesNotCapture(ArgNo))
+    return true;
+  const Function *Callee = CI->getCalledFunction();
+  if (!Callee)
+    return false;
+  if (isThreadLocalRuntimeCall(Callee->getName()))
+    return true;
+  if (ArgNo >= Callee->arg_size() || Callee->isVarArg())
+    return false;
+  const Argument *Param = &*std::next(Callee->arg_begin(), ArgNo);
+  return PrivateArgs.count(Param);
+}
+
+// Walks the uses of Root and reports whether its address can become
+// visible to another thread.
+bool ThreadPrivateAccesses::escapes(const Value *Root) {
+  auto Cached = EscapeCache.find(Root);
+  if (Cached != EscapeCache.end())
+    return Cached->second;
+
+  bool Escapes = false;
+  SmallVector<const Value *, 16> Worklist;
+  SmallPtrSet<const Value *, 16> Visited;
+  Worklist.push_back(Root);
+  Visited.insert(Root);
+  while (!Worklist.empty() && !Escapes) {
+    const Value *V = Worklist.pop_back_val();
+    for (const Use &U : V->uses()) {
+      const User *Usr = U.getUser();
+      if (isa<LoadInst>(Usr) || isa<ICmpInst>(Usr))
+        continue;
+      if (const StoreInst *SI = dyn_cast<StoreInst>(Usr)) {
+        if (SI->getValueOperand() == V) {
+          Escapes = true;
+          break;
+        }
+        continue;
+      }
+      if (const AtomicRMWInst *RMW = dyn_cast<AtomicRMWInst>(Usr)) {
+        if (RMW->getPointerOperand() == V && RMW->getValOperand() != V)
+          continue;
+        Escapes = true;
+        break;
+      }
+      if (const AtomicCmpXchgInst *CX = dyn_cast<AtomicCmpXchgInst>(Usr)) {
+        if (CX->getPointerOperand() == V && CX->getCompareOperand() != V &&
+            CX->getNewValOperand() != V)
+          continue;
+        Escapes = true;
+        break;
+      }
+      if (isa<GetElementPtrInst>(Usr) || isa<BitCastInst>(Usr) ||
+          isa<AddrSpaceCastInst>(Usr) || isa<PHINode>(Usr) ||
+          isa<SelectInst>(Usr)) {
+        if (Visited.insert(Usr).second)
+          Worklist.push_back(Usr);
+        continue;
+      }
+      if (const CallInst *CI = dyn_cast<CallInst>(Usr)) {
+        if (U.getOperandNo() < CI->getNumArgOperands() &&
+            callKeepsPrivate(CI, U.getOperandNo()))
+          continue;
+      }
+      // Returned, converted to an integer, passed to an unknown callee or
+      // used in any other way we do not follow.
+      Escapes = true;
+      break;
+    }
+  }
+  EscapeCache[Root] = Escapes;
+  return Escapes;
+}
+
+bool ThreadPrivateAccesses::isPrivatePointer(Value *Ptr, const DataLayout &DL) {
+  SmallVector<Value *, 4> Objects;
+  GetUnderlyingObjects(Ptr, Objects, DL);
+  if (Objects.empty())
+    return false;
+  for (Value *Obj : Objects) {
+    if (isa<AllocaInst>(Obj)) {
+      if (escapes(Obj))
+        return false;
+    } else if (const Argument *A = dyn_cast<Argument>(Obj)) {
+      if (!PrivateArgs.count(A))
+        return false;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ThreadPrivateAccesses::isPrivateArgument(const Argument *A) {
+  const Function *F = A->getParent();
+  const DataLayout &DL = F->getParent()->getDataLayout();
+  for (const Use &U : F->uses()) {
+    if (getForkCallOfMicrotask(U)) {
+      if (A->getArgNo() >= Microtasks.lookup(F))
+        return false;
+      continue;
+    }
+    const CallInst *CI = cast<CallInst>(U.getUser());
+    if (!isPrivatePointer(CI->getArgOperand(A->getArgNo()), DL))
+      return false;
+  }
+  return !escapes(A);
+}
+
+bool ThreadPrivateAccesses::markPrivateAccesses(Function &F) {
+  const DataLayout &DL = F.getParent()->getDataLayout();
+  bool Changed = false;
+  for (auto &BB : F) {
+    for (auto &Inst : BB) {
+      SmallVector<Value *, 2> Pointers;
+      if (LoadInst *LI = dyn_cast<LoadInst>(&Inst)) {
+        if (LI->isAtomic())
+          continue;
+        Pointers.push_back(LI->getPointerOperand());
+      } else if (StoreInst *SI = dyn_cast<StoreInst>(&Inst)) {
+        if (SI->isAtomic())
+          continue;
+        Pointers.push_back(SI->getPointerOperand());
+      } else if (MemTransferInst *MT = dyn_cast<MemTransferInst>(&Inst)) {
+        Pointers.push_back(MT->getRawDest());
+        Pointers.push_back(MT->getRawSource());
+      } else if (MemSetInst *MS = dyn_cast<MemSetInst>(&Inst)) {
+        Pointers.push_back(MS->getRawDest());
+      } else {
+        continue;
+      }
+
+      bool Private = true;
+      bool SkippedByTsan = true;
+      for (Value *Ptr : Pointers) {
+        if (!isPrivatePointer(Ptr, DL)) {
+          Private = false;
+          break;
+        }
+        // ThreadSanitizer already ignores addresses of allocas that are
+        // not captured.
+        if (!isa<AllocaInst>(GetUnderlyingObject(Ptr, DL)) ||
+            PointerMayBeCaptured(Ptr, true, true))
+          SkippedByTsan = false;
+      }
+      if (!Private || (SkippedByTsan && !isa<MemIntrinsic>(Inst)))
+        continue;
+      markArcherSafeAccess(&Inst, "private");
+      ++NumPrivateAccesses;
+      Changed = true;
+    }
+  }
+  return Changed;
+}
+
+bool ThreadPrivateAccesses::runOnModule(Module &M) {
+  PrivateArgs.clear();
+  Microtasks.clear();
+  collectMicrotasks(M);
+
+  // Start from the optimistic assumption that every candidate pointer
+  // argument is private and drop arguments until nothing changes.
+  for (auto &F : M) {
+    if (!isCandidate(F))
+      continue;
+    unsigned Limit = Microtasks.count(&F) ? Microtasks.lookup(&F) : F.arg_size();
+    for (auto &A : F.args())
+      if (A.getType()->isPointerTy() && A.getArgNo() < Limit)
+        PrivateArgs.insert(&A);
+  }
+
+  bool Changed = true;
+  while (Changed) {
+    Changed = false;
+    EscapeCache.clear();
+    SmallVector<const Argument *, 16> Candidates(PrivateArgs.begin(),
+                                                 PrivateArgs.end());
+    for (const Argument *A : Candidates) {
+      if (!isPrivateArgument(A)) {
+        PrivateArgs.erase(A);
+        EscapeCache.clear();
+        Changed = true;
+      }
+    }
+  }
+
+  bool Modified = false;
+  for (auto &F : M) {
+    if (F.isDeclaration() || !F.hasFnAttribute(Attribute::SanitizeThread))
+      continue;
+    Modified |= markPrivateAccesses(F);
+  }
+  return Modified;
+}
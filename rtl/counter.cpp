@@ -93,6 +93,10 @@ void print_callbacks(callback_counter_t *counter){
     OUTPUT_IF_NOT_NULL("%5d sync_region : scope_end : barrier\n", counter[0].sync_region_scope_end_barrier);
     OUTPUT_IF_NOT_NULL("%5d sync_region : scope_end : taskwait\n", counter[0].sync_region_scope_end_taskwait);
     OUTPUT_IF_NOT_NULL("%5d sync_region : scope_end : taskgroup\n", counter[0].sync_region_scope_end_taskgroup);
+    OUTPUT_IF_NOT_NULL("%5d work : scope_begin : taskloop\n", counter[0].work_scope_begin_taskloop);
+    OUTPUT_IF_NOT_NULL("%5d work : scope_end : taskloop\n", counter[0].work_scope_end_taskloop);
+    OUTPUT_IF_NOT_NULL("%5d reduction : scope_begin\n", counter[0].reduction_scope_begin);
+    OUTPUT_IF_NOT_NULL("%5d reduction : scope_end\n", counter[0].reduction_scope_end);
     OUTPUT_IF_NOT_NULL("%5d lock_init_lock\n", counter[0].lock_init_lock);
     OUTPUT_IF_NOT_NULL("%5d lock_init_nest_lock\n", counter[0].lock_init_nest_lock);
     OUTPUT_IF_NOT_NULL("%5d lock_init_default\n", counter[0].lock_init_default);
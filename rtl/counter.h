@@ -90,6 +90,10 @@ typedef struct alignas(128) {
     int sync_region_scope_end_barrier;    	//                  	scope_end:	sync_region_barrier
     int sync_region_scope_end_taskwait;   	//                                      sync_region_taskwait
     int sync_region_scope_end_taskgroup;  	//                                      sync_region_taskgroup
+    int work_scope_begin_taskloop;		// (20) work:		scope_begin:	work_taskloop
+    int work_scope_end_taskloop;		//			scope_end:	work_taskloop
+    int reduction_scope_begin;			// (31) reduction:	scope_begin
+    int reduction_scope_end;			//			scope_end
     int lock_init_lock;				// (22) lock_init:	mutex_lock
     int lock_init_nest_lock;			// 			mutex_nest_lock
     int lock_init_default;			//			default
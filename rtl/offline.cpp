@@ -0,0 +1,438 @@
+/*
+Copyright (c) 2015-2019, Lawrence Livermore National Security, LLC.
+
+Produced at the Lawrence Livermore National Laboratory
+
+Written by Simone Atzeni (simone@cs.utah.edu), Joachim Protze
+(joachim.protze@tu-dresden.de), Jonas Hahnfeld
+(hahnfeld@itc.rwth-aachen.de), Ganesh Gopalakrishnan, Zvonimir
+Rakamaric, Dong H. Ahn, Gregory L. Lee, Ignacio Laguna, and Martin
+Schulz.
+
+LLNL-CODE-773957
+
+All rights reserved.
+
+This file is part of Archer. For details, see
+https://pruners.github.io/archer. Please also read
+https://github.com/PRUNERS/archer/blob/master/LICENSE.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+   Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the disclaimer below.
+
+   Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the disclaimer (as noted below)
+   in the documentation and/or other materials provided with the
+   distribution.
+
+   Neither the name of the LLNS/LLNL nor the names of its contributors
+   may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LAWRENCE
+LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Offline race detection backend.
+//
+// Applications are compiled with ThreadSanitizer instrumentation as usual,
+// but linked against this library instead of the ThreadSanitizer runtime
+// (clang-archer --offline). The library implements the entry points called
+// by the instrumentation and the dynamic annotations used by the Archer
+// OMPT tool. Instead of maintaining shadow memory, every thread appends its
+// memory accesses and synchronization events to a buffer that is written
+// to a log file whenever it is full. tools/archer-offline-analyze finds the
+// data races after the execution. The memory overhead at runtime is
+// bounded by the size of the buffers.
+
+#include "offline.h"
+
+#include <atomic>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <malloc.h>
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef uintptr_t uptr;
+
+// A single event needs at most one tag byte and three LEB128 numbers.
+#define MAX_EVENT_SIZE 32
+
+struct ThreadLog {
+  int fd;
+  uint8_t *buffer;
+  uint8_t *pos;
+  uint8_t *end;
+  uptr last_addr;
+  uptr last_pc;
+  int ignore_writes;
+  ThreadLog *next;
+};
+
+static __thread ThreadLog *this_log __attribute__((tls_model("initial-exec")));
+
+static ThreadLog *all_logs;
+static std::mutex logs_mutex;
+static std::atomic<uint64_t> next_thread_id;
+static std::atomic<uint64_t> sync_seq;
+static size_t buffer_size = 1 << 20;
+static int initialized;
+
+static void flush_log(ThreadLog *log) {
+  uint8_t *p = log->buffer;
+  while (p < log->pos) {
+    ssize_t n = write(log->fd, p, log->pos - p);
+    if (n <= 0)
+      break;
+    p += n;
+  }
+  log->pos = log->buffer;
+}
+
+static void write_maps() {
+  char filename[64];
+  snprintf(filename, sizeof(filename), "archer_log.%d.maps", getpid());
+  int in = open("/proc/self/maps", O_RDONLY);
+  int out = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (in >= 0 && out >= 0) {
+    char buf[4096];
+    ssize_t n;
+    while ((n = read(in, buf, sizeof(buf))) > 0)
+      if (write(out, buf, n) != n)
+        break;
+  }
+  if (in >= 0)
+    close(in);
+  if (out >= 0)
+    close(out);
+}
+
+static void flush_all_logs() {
+  logs_mutex.lock();
+  for (ThreadLog *log = all_logs; log; log = log->next)
+    flush_log(log);
+  logs_mutex.unlock();
+  // Libraries may have been loaded after the start of the program.
+  write_maps();
+}
+
+static void initialize() {
+  if (initialized)
+    return;
+  initialized = 1;
+  // The buffer size is shared with the other ARCHER_OPTIONS.
+  const char *options = getenv("ARCHER_OPTIONS");
+  const char *size = options ? strstr(options, "log_buffer_size=") : NULL;
+  int kbytes;
+  if (size && sscanf(size, "log_buffer_size=%d", &kbytes) == 1 && kbytes > 0)
+    buffer_size = (size_t)kbytes << 10;
+  atexit(flush_all_logs);
+}
+
+static ThreadLog *new_log() {
+  initialize();
+  ThreadLog *log = (ThreadLog *)calloc(1, sizeof(ThreadLog));
+  uint64_t thread_id = next_thread_id++;
+  char filename[64];
+  snprintf(filename, sizeof(filename), "archer_log.%d.%" PRIu64, getpid(), thread_id);
+  log->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (log->fd < 0) {
+    fprintf(stderr, "Archer: could not open log file %s\n", filename);
+    exit(1);
+  }
+  log->buffer = (uint8_t *)malloc(buffer_size);
+  log->pos = log->buffer;
+  log->end = log->buffer + buffer_size - MAX_EVENT_SIZE;
+
+  offline_log_header_t header = {OFFLINE_MAGIC, OFFLINE_VERSION, thread_id};
+  memcpy(log->pos, &header, sizeof(header));
+  log->pos += sizeof(header);
+
+  logs_mutex.lock();
+  log->next = all_logs;
+  all_logs = log;
+  logs_mutex.unlock();
+  this_log = log;
+  return log;
+}
+
+static inline ThreadLog *get_log() {
+  ThreadLog *log = this_log;
+  if (__builtin_expect(log == NULL, 0))
+    log = new_log();
+  else if (__builtin_expect(log->pos >= log->end, 0))
+    flush_log(log);
+  return log;
+}
+
+static inline void log_access(uptr addr, uptr size, offline_access_kind_t kind, uptr pc) {
+  ThreadLog *log = get_log();
+  if ((kind & offline_write) && log->ignore_writes)
+    return;
+  unsigned size_code;
+  switch (size) {
+    case 1: size_code = 0; break;
+    case 2: size_code = 1; break;
+    case 4: size_code = 2; break;
+    case 8: size_code = 3; break;
+    case 16: size_code = 4; break;
+    default: size_code = OFFLINE_SIZE_EXPLICIT; break;
+  }
+  uint8_t *p = log->pos;
+  *p++ = (size_code << 2) | kind;
+  p = offline_put_sleb(p, (int64_t)(addr - log->last_addr));
+  p = offline_put_sleb(p, (int64_t)(pc - log->last_pc));
+  if (size_code == OFFLINE_SIZE_EXPLICIT)
+    p = offline_put_uleb(p, size);
+  log->pos = p;
+  log->last_addr = addr;
+  log->last_pc = pc;
+}
+
+static inline void log_sync(uint8_t tag, uptr addr, uptr size = 0) {
+  ThreadLog *log = get_log();
+  uint8_t *p = log->pos;
+  *p++ = tag;
+  p = offline_put_uleb(p, addr);
+  if (tag == OFFLINE_TAG_NEW_MEMORY)
+    p = offline_put_uleb(p, size);
+  p = offline_put_uleb(p, sync_seq++);
+  log->pos = p;
+}
+
+#define CALLERPC ((uptr)__builtin_return_address(0))
+
+extern "C" {
+
+// Entry points of the ThreadSanitizer instrumentation.
+
+void __tsan_init() { initialize(); }
+void __tsan_func_entry(void *pc) {}
+void __tsan_func_exit() {}
+
+#define ACCESS_FUNCTIONS(size)                                                \
+  void __tsan_read##size(void *addr) {                                        \
+    log_access((uptr)addr, size, offline_read, CALLERPC);                     \
+  }                                                                           \
+  void __tsan_write##size(void *addr) {                                       \
+    log_access((uptr)addr, size, offline_write, CALLERPC);                    \
+  }                                                                           \
+  void __tsan_unaligned_read##size(void *addr) {                              \
+    log_access((uptr)addr, size, offline_read, CALLERPC);                     \
+  }                                                                           \
+  void __tsan_unaligned_write##size(void *addr) {                             \
+    log_access((uptr)addr, size, offline_write, CALLERPC);                    \
+  }                                                                           \
+  void __tsan_volatile_read##size(void *addr) {                               \
+    log_access((uptr)addr, size, offline_read, CALLERPC);                     \
+  }                                                                           \
+  void __tsan_volatile_write##size(void *addr) {                              \
+    log_access((uptr)addr, size, offline_write, CALLERPC);                    \
+  }
+
+ACCESS_FUNCTIONS(1)
+ACCESS_FUNCTIONS(2)
+ACCESS_FUNCTIONS(4)
+ACCESS_FUNCTIONS(8)
+ACCESS_FUNCTIONS(16)
+
+void __tsan_read_range(void *addr, uptr size) {
+  log_access((uptr)addr, size, offline_read, CALLERPC);
+}
+void __tsan_write_range(void *addr, uptr size) {
+  log_access((uptr)addr, size, offline_write, CALLERPC);
+}
+
+void __tsan_vptr_read(void **vptr_p) {
+  log_access((uptr)vptr_p, sizeof(void *), offline_read, CALLERPC);
+}
+void __tsan_vptr_update(void **vptr_p, void *new_val) {
+  if (*vptr_p != new_val)
+    log_access((uptr)vptr_p, sizeof(void *), offline_write, CALLERPC);
+}
+
+void *__tsan_memcpy(void *dst, const void *src, uptr size) {
+  log_access((uptr)src, size, offline_read, CALLERPC);
+  log_access((uptr)dst, size, offline_write, CALLERPC);
+  return memcpy(dst, src, size);
+}
+void *__tsan_memmove(void *dst, const void *src, uptr size) {
+  log_access((uptr)src, size, offline_read, CALLERPC);
+  log_access((uptr)dst, size, offline_write, CALLERPC);
+  return memmove(dst, src, size);
+}
+void *__tsan_memset(void *dst, int value, uptr size) {
+  log_access((uptr)dst, size, offline_write, CALLERPC);
+  return memset(dst, value, size);
+}
+
+// Atomic operations never race with each other. Release and acquire
+// semantics are logged as synchronization on the address of the atomic.
+
+typedef enum {
+  mo_relaxed,
+  mo_consume,
+  mo_acquire,
+  mo_release,
+  mo_acq_rel,
+  mo_seq_cst
+} morder;
+
+static inline bool is_release(morder mo) { return mo >= mo_release; }
+static inline bool is_acquire(morder mo) {
+  return mo == mo_consume || mo == mo_acquire || mo >= mo_acq_rel;
+}
+
+#define ATOMIC_LOAD_STORE(T, size)                                            \
+  T __tsan_atomic##size##_load(const volatile T *a, morder mo) {              \
+    T v = __atomic_load_n(a, __ATOMIC_SEQ_CST);                               \
+    log_access((uptr)a, sizeof(T), offline_atomic_read, CALLERPC);            \
+    if (is_acquire(mo))                                                       \
+      log_sync(OFFLINE_TAG_ACQUIRE, (uptr)a);                                 \
+    return v;                                                                 \
+  }                                                                           \
+  void __tsan_atomic##size##_store(volatile T *a, T v, morder mo) {           \
+    if (is_release(mo))                                                       \
+      log_sync(OFFLINE_TAG_RELEASE, (uptr)a);                                 \
+    log_access((uptr)a, sizeof(T), offline_atomic_write, CALLERPC);           \
+    __atomic_store_n(a, v, __ATOMIC_SEQ_CST);                                 \
+  }
+
+#define ATOMIC_RMW(T, size, name, op)                                         \
+  T __tsan_atomic##size##_##name(volatile T *a, T v, morder mo) {             \
+    if (is_release(mo))                                                       \
+      log_sync(OFFLINE_TAG_RELEASE, (uptr)a);                                 \
+    log_access((uptr)a, sizeof(T), offline_atomic_write, CALLERPC);           \
+    T ret = op(a, v, __ATOMIC_SEQ_CST);                                       \
+    if (is_acquire(mo))                                                       \
+      log_sync(OFFLINE_TAG_ACQUIRE, (uptr)a);                                 \
+    return ret;                                                               \
+  }
+
+#define ATOMIC_CAS(T, size)                                                   \
+  int __tsan_atomic##size##_compare_exchange_strong(volatile T *a, T *c, T v, \
+                                                    morder mo, morder fmo) {  \
+    if (is_release(mo))                                                       \
+      log_sync(OFFLINE_TAG_RELEASE, (uptr)a);                                 \
+    log_access((uptr)a, sizeof(T), offline_atomic_write, CALLERPC);           \
+    int ret = __atomic_compare_exchange_n(a, c, v, false, __ATOMIC_SEQ_CST,   \
+                                          __ATOMIC_SEQ_CST);                  \
+    if (is_acquire(ret ? mo : fmo))                                           \
+      log_sync(OFFLINE_TAG_ACQUIRE, (uptr)a);                                 \
+    return ret;                                                               \
+  }                                                                           \
+  int __tsan_atomic##size##_compare_exchange_weak(volatile T *a, T *c, T v,   \
+                                                  morder mo, morder fmo) {    \
+    return __tsan_atomic##size##_compare_exchange_strong(a, c, v, mo, fmo);   \
+  }                                                                           \
+  T __tsan_atomic##size##_compare_exchange_val(volatile T *a, T c, T v,       \
+                                               morder mo, morder fmo) {       \
+    __tsan_atomic##size##_compare_exchange_strong(a, &c, v, mo, fmo);         \
+    return c;                                                                 \
+  }
+
+#define ATOMIC_FUNCTIONS(T, size)                                             \
+  ATOMIC_LOAD_STORE(T, size)                                                  \
+  ATOMIC_RMW(T, size, exchange, __atomic_exchange_n)                          \
+  ATOMIC_RMW(T, size, fetch_add, __atomic_fetch_add)                          \
+  ATOMIC_RMW(T, size, fetch_sub, __atomic_fetch_sub)                          \
+  ATOMIC_RMW(T, size, fetch_and, __atomic_fetch_and)                          \
+  ATOMIC_RMW(T, size, fetch_or, __atomic_fetch_or)                            \
+  ATOMIC_RMW(T, size, fetch_xor, __atomic_fetch_xor)                          \
+  ATOMIC_RMW(T, size, fetch_nand, __atomic_fetch_nand)                        \
+  ATOMIC_CAS(T, size)
+
+ATOMIC_FUNCTIONS(uint8_t, 8)
+ATOMIC_FUNCTIONS(uint16_t, 16)
+ATOMIC_FUNCTIONS(uint32_t, 32)
+ATOMIC_FUNCTIONS(uint64_t, 64)
+// 16 byte atomics need cmpxchg16b (-mcx16), otherwise libatomic.
+#if defined(__GCC_HAVE_SYNC_COMPARE_AND_SWAP_16)
+ATOMIC_FUNCTIONS(unsigned __int128, 128)
+#endif
+
+void __tsan_atomic_thread_fence(morder mo) { __atomic_thread_fence(__ATOMIC_SEQ_CST); }
+void __tsan_atomic_signal_fence(morder mo) { __atomic_signal_fence(__ATOMIC_SEQ_CST); }
+
+// Dynamic annotations used by the Archer OMPT tool.
+
+void AnnotateHappensBefore(const char *file, int line, const volatile void *cv) {
+  log_sync(OFFLINE_TAG_RELEASE, (uptr)cv);
+}
+void AnnotateHappensAfter(const char *file, int line, const volatile void *cv) {
+  log_sync(OFFLINE_TAG_ACQUIRE, (uptr)cv);
+}
+void AnnotateIgnoreWritesBegin(const char *file, int line) {
+  get_log()->ignore_writes++;
+}
+void AnnotateIgnoreWritesEnd(const char *file, int line) {
+  get_log()->ignore_writes--;
+}
+void AnnotateNewMemory(const char *file, int line, const volatile void *cv, size_t size) {
+  log_sync(OFFLINE_TAG_NEW_MEMORY, (uptr)cv, size);
+}
+
+// The Archer OMPT tool only activates itself if it runs under
+// ThreadSanitizer, which defines this function.
+int RunningOnValgrind() { return 0; }
+
+// Without the ThreadSanitizer runtime there are no interceptors. Heap
+// memory may be reused by an unrelated allocation of another thread, so we
+// log freed and allocated memory as new memory. Allocations are only logged
+// for threads that already have a log, new_log allocates itself.
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+void *malloc(size_t size) {
+  void *ret = __libc_malloc(size);
+  if (ret && this_log)
+    log_sync(OFFLINE_TAG_NEW_MEMORY, (uptr)ret, size);
+  return ret;
+}
+
+void *calloc(size_t n, size_t size) {
+  void *ret = __libc_calloc(n, size);
+  if (ret && this_log)
+    log_sync(OFFLINE_TAG_NEW_MEMORY, (uptr)ret, n * size);
+  return ret;
+}
+
+void free(void *ptr) {
+  if (ptr && this_log)
+    log_sync(OFFLINE_TAG_NEW_MEMORY, (uptr)ptr, malloc_usable_size(ptr));
+  __libc_free(ptr);
+}
+
+void *realloc(void *ptr, size_t size) {
+  size_t old_size = ptr ? malloc_usable_size(ptr) : 0;
+  void *ret = __libc_realloc(ptr, size);
+  if (ret != ptr && this_log) {
+    if (ptr)
+      log_sync(OFFLINE_TAG_NEW_MEMORY, (uptr)ptr, old_size);
+    if (ret)
+      log_sync(OFFLINE_TAG_NEW_MEMORY, (uptr)ret, size);
+  }
+  return ret;
+}
+
+} // extern "C"
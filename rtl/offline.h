@@ -0,0 +1,138 @@
+/*
+Copyright (c) 2015-2019, Lawrence Livermore National Security, LLC.
+
+Produced at the Lawrence Livermore National Laboratory
+
+Written by Simone Atzeni (simone@cs.utah.edu), Joachim Protze
+(joachim.protze@tu-dresden.de), Jonas Hahnfeld
+(hahnfeld@itc.rwth-aachen.de), Ganesh Gopalakrishnan, Zvonimir
+Rakamaric, Dong H. Ahn, Gregory L. Lee, Ignacio Laguna, and Martin
+Schulz.
+
+LLNL-CODE-773957
+
+All rights reserved.
+
+This file is part of Archer. For details, see
+https://pruners.github.io/archer. Please also read
+https://github.com/PRUNERS/archer/blob/master/LICENSE.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+   Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the disclaimer below.
+
+   Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the disclaimer (as noted below)
+   in the documentation and/or other materials provided with the
+   distribution.
+
+   Neither the name of the LLNS/LLNL nor the names of its contributors
+   may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LAWRENCE
+LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Format of the memory access logs written by the offline backend
+// (libarcher_offline) and read by tools/archer-offline-analyze.
+//
+// Every thread writes its own log archer_log.<pid>.<thread>. A log starts
+// with an offline_log_header_t followed by a stream of events. Each event
+// starts with a tag byte:
+//
+//  - memory access: (size code << 2) | access kind, followed by the
+//    zigzag/LEB128 encoded differences of the address and the pc to the
+//    previous access of this thread. A size code of OFFLINE_SIZE_EXPLICIT
+//    is followed by the LEB128 encoded size in bytes.
+//  - synchronization (OFFLINE_TAG_RELEASE, OFFLINE_TAG_ACQUIRE): LEB128
+//    encoded address of the synchronization object and the global sequence
+//    number of the event.
+//  - OFFLINE_TAG_NEW_MEMORY: address, size and sequence number.
+//
+// Synchronization events end the current segment of the thread. The
+// sequence numbers give a global order of all synchronization events.
+// The memory map of the process is stored in archer_log.<pid>.maps.
+
+#ifndef ARCHER_OFFLINE_H
+#define ARCHER_OFFLINE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define OFFLINE_MAGIC 0x4c524341 // "ACRL"
+#define OFFLINE_VERSION 1
+
+typedef enum {
+    offline_read = 0,
+    offline_write = 1,
+    offline_atomic_read = 2,
+    offline_atomic_write = 3
+} offline_access_kind_t;
+
+#define OFFLINE_SIZE_EXPLICIT 5
+
+#define OFFLINE_TAG_RELEASE 0xf0
+#define OFFLINE_TAG_ACQUIRE 0xf1
+#define OFFLINE_TAG_NEW_MEMORY 0xf2
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t thread_id;
+} offline_log_header_t;
+
+static inline uint8_t *offline_put_uleb(uint8_t *p, uint64_t value) {
+    do {
+        uint8_t byte = value & 0x7f;
+        value >>= 7;
+        if (value)
+            byte |= 0x80;
+        *p++ = byte;
+    } while (value);
+    return p;
+}
+
+static inline uint8_t *offline_put_sleb(uint8_t *p, int64_t value) {
+    // zigzag encoding keeps small negative differences small
+    return offline_put_uleb(p, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+}
+
+static inline const uint8_t *offline_get_uleb(const uint8_t *p, const uint8_t *end, uint64_t *value) {
+    uint64_t result = 0;
+    unsigned shift = 0;
+    while (p < end) {
+        uint8_t byte = *p++;
+        result |= (uint64_t)(byte & 0x7f) << shift;
+        shift += 7;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static inline const uint8_t *offline_get_sleb(const uint8_t *p, const uint8_t *end, int64_t *value) {
+    uint64_t zigzag;
+    p = offline_get_uleb(p, end, &zigzag);
+    if (!p)
+        return NULL;
+    *value = (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+    return p;
+}
+
+#endif // ARCHER_OFFLINE_H
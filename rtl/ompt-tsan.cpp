@@ -48,6 +48,11 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
 #include "counter.h"
+#include "trace.h"
+#include "profile.h"
+#include "perf.h"
+#include "timeline.h"
+#include "schedule.h"
 
 #ifndef __STDC_FORMAT_MACROS
 #define __STDC_FORMAT_MACROS
@@ -67,11 +72,11 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <unordered_map>
 #include <vector>
 
-#if (defined __APPLE__ && defined __MACH__)
 #include <dlfcn.h>
-#endif
-
+#include <sched.h>
 #include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
 #define _OPENMP
 #include "omp.h"
 // #if !defined(__powerpc64__)
@@ -89,13 +94,34 @@ public:
 #endif
   int print_ompt_counters;
   int print_max_rss;
+  int print_region_profile;
+  int perf_counters;
+  int memory_timeline;
+  int perturb_schedule;
+  int perturb_seed;
+  int record_schedule;
+  int replay_schedule;
+  int trace_events;
+  int trace_buffer_size;
+  // Read by the offline backend (libarcher_offline).
+  int log_buffer_size;
 
   ArcherFlags(const char *env) :
 #if (LLVM_VERSION) >= 40
     flush_shadow(0),
 #endif
     print_ompt_counters(0),
-    print_max_rss(0) {
+    print_max_rss(0),
+    print_region_profile(0),
+    perf_counters(0),
+    memory_timeline(0),
+    perturb_schedule(0),
+    perturb_seed(0),
+    record_schedule(0),
+    replay_schedule(0),
+    trace_events(0),
+    trace_buffer_size(64),
+    log_buffer_size(1024) {
     if(env) {
       std::vector<std::string> tokens;
       std::string token;
@@ -113,6 +139,26 @@ public:
           continue;
         if (sscanf(it->c_str(), "print_max_rss=%d", &print_max_rss))
           continue;
+        if (sscanf(it->c_str(), "print_region_profile=%d", &print_region_profile))
+          continue;
+        if (sscanf(it->c_str(), "perf_counters=%d", &perf_counters))
+          continue;
+        if (sscanf(it->c_str(), "memory_timeline=%d", &memory_timeline))
+          continue;
+        if (sscanf(it->c_str(), "perturb_schedule=%d", &perturb_schedule))
+          continue;
+        if (sscanf(it->c_str(), "perturb_seed=%d", &perturb_seed))
+          continue;
+        if (sscanf(it->c_str(), "record_schedule=%d", &record_schedule))
+          continue;
+        if (sscanf(it->c_str(), "replay_schedule=%d", &replay_schedule))
+          continue;
+        if (sscanf(it->c_str(), "trace_events=%d", &trace_events))
+          continue;
+        if (sscanf(it->c_str(), "trace_buffer_size=%d", &trace_buffer_size))
+          continue;
+        if (sscanf(it->c_str(), "log_buffer_size=%d", &log_buffer_size))
+          continue;
         std::cerr << "Illegal values for ARCHER_OPTIONS variable: " << token << std::endl;
       }
     }
@@ -214,6 +260,10 @@ static ompt_get_thread_data_t ompt_get_thread_data;
 typedef int (* ompt_get_task_memory_t) (void** addr, size_t* size, int blocknum);
 static ompt_get_task_memory_t ompt_get_task_memory_info;
 
+/// Whether the runtime reports its reductions, which allows us to only ignore
+/// writes during the reduction instead of during the whole barrier.
+static int hasReductionCallback;
+
 typedef uint64_t ompt_tsan_clockid;
 
 static uint64_t my_next_id()
@@ -288,10 +338,34 @@ struct DataPool {
   }
 
   DataPool() : DPMutex(), DataPointer(), total(0)
-  {}
+  {
+    AllPoolsMutex.lock();
+    AllPools.push_back(this);
+    AllPoolsMutex.unlock();
+  }
 
+  /// All pools of this type, for the memory timeline.
+  static std::mutex AllPoolsMutex;
+  static std::vector<DataPool *> AllPools;
+
+  /// Sum up the objects allocated by all pools and the objects in use.
+  static void Sample(int *Total, int *Used) {
+    AllPoolsMutex.lock();
+    for (DataPool *Pool : AllPools) {
+      Pool->DPMutex.lock();
+      *Total += Pool->total;
+      *Used += Pool->total - Pool->DataPointer.size();
+      Pool->DPMutex.unlock();
+    }
+    AllPoolsMutex.unlock();
+  }
 };
 
+template <typename T, int N>
+std::mutex DataPool<T,N>::AllPoolsMutex;
+template <typename T, int N>
+std::vector<DataPool<T,N> *> DataPool<T,N>::AllPools;
+
 // This function takes care to return the data to the originating DataPool
 // A pointer to the originating DataPool is stored just before the actual data.
 template <typename T, int N>
@@ -310,6 +384,19 @@ struct ParallelData {
   /// Two addresses for relationships with barriers.
   ompt_tsan_clockid Barrier[2];
 
+  /// Begin time and peak RSS for the region profile.
+  uint64_t ProfileTime;
+  long ProfileRss;
+
+  /// Location of the region to attribute the perf counters of the implicit
+  /// tasks to.
+  const void *ProfileCodePtr;
+
+  /// Data of the client tool (ARCHER_TOOL_LIBRARIES).
+  ompt_data_t ClientData;
+
+  ParallelData() : ProfileCodePtr(nullptr), ClientData() {}
+
   void *GetParallelPtr() {
     return &(Barrier[1]);
   }
@@ -376,18 +463,34 @@ struct TaskData {
   /// this task.
   ompt_tsan_clockid Taskwait;
 
+  /// Tasks created by a taskloop of this task use its address to declare
+  /// their relationship to the creation.
+  ompt_tsan_clockid Taskloop;
+
   /// Whether this task is currently executing a barrier.
   bool InBarrier;
 
   /// Whether this task is currently executing a barrier.
   bool Included;
 
+  /// Whether this task is currently creating the tasks of a taskloop.
+  bool InTaskloop;
+
+  /// Whether this task is currently executing a reduction in the runtime.
+  bool InReduction;
+
+  /// Whether this task synchronizes with the Taskloop clock of its parent.
+  bool Batched;
+
   /// Index of which barrier to use next.
   char BarrierIndex;
 
   /// Count how often this structure has been put into child tasks + 1.
   std::atomic_int RefCount;
 
+  /// Number of batched child tasks that did not start execution yet.
+  std::atomic_int TaskloopPending;
+
   /// Reference to the parent that created this task.
   TaskData* Parent;
 
@@ -410,11 +513,26 @@ struct TaskData {
   void* PrivateData;
   size_t PrivateDataSize;
 
+  /// Creation site and begin of the current execution slice for the region
+  /// profile, only set for explicit tasks.
+  const void *ProfileCodePtr;
+  uint64_t ProfileTime;
+  long ProfileRss;
+
+  /// Perf counters at the begin of the current execution slice of an
+  /// explicit task or of the implicit task, and the parallel region of the
+  /// implicit task.
+  uint64_t PerfBegin[PERF_COUNTERS];
+  const void *ProfileRegion;
+
+  /// Data of the client tool (ARCHER_TOOL_LIBRARIES).
+  ompt_data_t ClientData;
+
   int execution;
   int freed;
 
-  TaskData(TaskData* Parent) : InBarrier(false), Included(false), BarrierIndex(0),
-    RefCount(1), Parent(Parent), ImplicitTask(nullptr), Team(Parent->Team), TaskGroup(nullptr), DependencyCount(0), execution(0), freed(0) {
+  TaskData(TaskData* Parent) : InBarrier(false), Included(false), InTaskloop(false),
+    InReduction(false), Batched(false), BarrierIndex(0), RefCount(1), TaskloopPending(0), Parent(Parent), ImplicitTask(nullptr), Team(Parent->Team), TaskGroup(nullptr), DependencyCount(0), ProfileCodePtr(nullptr), ClientData(), execution(0), freed(0) {
     if (Parent != nullptr) {
       Parent->RefCount++;
       // Copy over pointer to taskgroup. This task may set up its own stack
@@ -423,13 +541,14 @@ struct TaskData {
     }
   }
 
-  TaskData(ParallelData* Team = nullptr) : InBarrier(false), Included(false), BarrierIndex(0),
-    RefCount(1), Parent(nullptr), ImplicitTask(this), Team(Team), TaskGroup(nullptr), DependencyCount(0), execution(1), freed(0) {
+  TaskData(ParallelData* Team = nullptr) : InBarrier(false), Included(false), InTaskloop(false),
+    InReduction(false), Batched(false), BarrierIndex(0), RefCount(1), TaskloopPending(0), Parent(nullptr), ImplicitTask(this), Team(Team), TaskGroup(nullptr), DependencyCount(0), ProfileCodePtr(nullptr), ClientData(), execution(1), freed(0) {
   }
 
   ~TaskData() {
     TsanDeleteClock(&Task);
     TsanDeleteClock(&Taskwait);
+    TsanDeleteClock(&Taskloop);
   }
 
   void *GetTaskPtr() {
@@ -439,6 +558,15 @@ struct TaskData {
   void *GetTaskwaitPtr() {
     return &Taskwait;
   }
+
+  void *GetTaskloopPtr() {
+    return &Taskloop;
+  }
+
+  /// Whether writes of the runtime are currently ignored for this task.
+  bool IgnoresWrites() {
+    return InBarrier || InTaskloop || InReduction;
+  }
   // overload new/delete to use DataPool for memory management.
   void * operator new(size_t size){
     return tdp->getData();
@@ -474,6 +602,91 @@ static inline void *ToInAddr(void* OutAddr) {
 std::unordered_map<ompt_wait_id_t, std::mutex> Locks;
 std::mutex LocksMutex;
 
+/// State of the execution for the memory timeline.
+static std::atomic<ParallelData *> TimelineRegion;
+static std::atomic<const void *> TimelineRegionCodePtr;
+static std::atomic<uint64_t> ShadowFlushes;
+
+static void TimelineSample(timeline_sample_t *Sample) {
+  DataPool<ParallelData,4>::Sample(&Sample->parallel_data_total, &Sample->parallel_data_used);
+  DataPool<Taskgroup,4>::Sample(&Sample->taskgroup_total, &Sample->taskgroup_used);
+  DataPool<TaskData,4>::Sample(&Sample->task_data_total, &Sample->task_data_used);
+  LocksMutex.lock();
+  Sample->locks = Locks.size();
+  LocksMutex.unlock();
+  Sample->shadow_flushes = ShadowFlushes;
+  Sample->region = TimelineRegionCodePtr;
+}
+
+/// Seed of the schedule perturbation, printed so that a run can be repeated.
+static unsigned PerturbSeed;
+__thread uint64_t PerturbState;
+
+static void PerturbThreadBegin(uint64_t ThreadId) {
+  // xorshift must not start from zero.
+  PerturbState = ((uint64_t)PerturbSeed << 32 | 0x9e3779b9) ^
+                 (ThreadId * 0x9e3779b97f4a7c15ULL);
+  if (!PerturbState)
+    PerturbState = 1;
+}
+
+/// Delay the calling thread by a random, bounded amount at an OMPT
+/// synchronization point to expose different interleavings of the threads.
+static void PerturbSchedule() {
+  if (!archer_flags->perturb_schedule || !PerturbState)
+    return;
+  PerturbState ^= PerturbState << 13;
+  PerturbState ^= PerturbState >> 7;
+  PerturbState ^= PerturbState << 17;
+  switch (PerturbState % 4) {
+    case 0:
+    case 1:
+      break;
+    case 2:
+      sched_yield();
+      break;
+    case 3:
+      usleep((PerturbState >> 8) % archer_flags->perturb_schedule + 1);
+      break;
+  }
+}
+
+/// Whether lock acquisitions and task switches are recorded or replayed.
+static bool RecordSchedule;
+static bool ReplaySchedule;
+
+extern "C" int __attribute__((weak)) __kmpc_global_thread_num(void *);
+
+__thread int ScheduleThreadId = -1;
+/// Whether this thread holds the turn of the replay between mutex_acquire
+/// and mutex_acquired.
+__thread bool ScheduleHoldsTurn;
+
+/// Id of the calling thread in the schedule log. The runtime assigns global
+/// thread ids in the order it creates the threads, so unlike our own ids they
+/// are stable across runs.
+static int ScheduleThread() {
+  if (ScheduleThreadId < 0)
+    ScheduleThreadId = __kmpc_global_thread_num
+                           ? __kmpc_global_thread_num(NULL)
+                           : (int)ompt_get_thread_data()->value;
+  return ScheduleThreadId;
+}
+
+static void ScheduleTaskSwitch() {
+  if (RecordSchedule)
+    schedule_record(SCHEDULE_TASK, ScheduleThread());
+  if (ReplaySchedule && schedule_replay_wait(SCHEDULE_TASK, ScheduleThread()))
+    schedule_replay_advance();
+}
+
+static void PrintPerturbSeed() {
+  fprintf(stderr, "Archer: perturb_schedule=%d perturb_seed=%u "
+          "(rerun with ARCHER_OPTIONS=\"perturb_schedule=%d perturb_seed=%u\")\n",
+          archer_flags->perturb_schedule, PerturbSeed,
+          archer_flags->perturb_schedule, PerturbSeed);
+}
+
 static inline void* ToWaitPtr(ompt_wait_id_t wait_id) {
   // FIXME: wait_ids may be in the same range as "normal" addresses are...
   return reinterpret_cast<void*>(wait_id);
@@ -496,7 +709,16 @@ ompt_tsan_thread_begin(
     this_event_counter = &(all_counter[thread_data->value]);
   else
     this_event_counter=NULL;
+  if(archer_flags->trace_events)
+    this_trace_buffer = trace_open(thread_data->value, archer_flags->trace_buffer_size);
+  if(archer_flags->print_region_profile || archer_flags->perf_counters)
+    this_profile_table = profile_open();
+  if(archer_flags->perf_counters)
+    this_perf = perf_open();
+  if(archer_flags->perturb_schedule)
+    PerturbThreadBegin(thread_data->value);
   COUNT_EVENT1(thread_begin);
+  TRACE_EVENT(thread_begin, 0, thread_type, 0, 0, NULL);
 }
 
 /*static void
@@ -522,9 +744,24 @@ ompt_tsan_parallel_begin(
 {
   ParallelData* Data = new ParallelData;
   parallel_data->ptr = Data;
+  if (this_profile_table) {
+    Data->ProfileTime = profile_now();
+    Data->ProfileRss = profile_max_rss();
+    Data->ProfileCodePtr = codeptr_ra;
+  }
+  if (archer_flags->memory_timeline) {
+    // Only the initial task has no enclosing parallel region at level 1.
+    int TeamSize;
+    ompt_data_t *Enclosing;
+    if (ompt_get_parallel_info(1, &Enclosing, &TeamSize) != 2) {
+      TimelineRegion = Data;
+      TimelineRegionCodePtr = codeptr_ra;
+    }
+  }
 
   TsanHappensBefore(Data->GetParallelPtr());
   COUNT_EVENT1(parallel_begin);
+  TRACE_EVENT(parallel_begin, ompt_scope_begin, requested_team_size, Data, parent_task_data->ptr, codeptr_ra);
 }
 
 static void
@@ -535,15 +772,25 @@ ompt_tsan_parallel_end(
   const void *codeptr_ra)
 {
   ParallelData* Data = ToParallelData(parallel_data);
+  TRACE_EVENT(parallel_end, ompt_scope_end, 0, Data, task_data->ptr, codeptr_ra);
   TsanHappensAfter(Data->GetBarrierPtr(0));
   TsanHappensAfter(Data->GetBarrierPtr(1));
+  if (this_profile_table)
+    profile_add(this_profile_table, profile_parallel, codeptr_ra, 1,
+                profile_now() - Data->ProfileTime, profile_max_rss() - Data->ProfileRss);
+  if (TimelineRegion == Data) {
+    TimelineRegion = nullptr;
+    TimelineRegionCodePtr = nullptr;
+  }
 
   delete Data;
 
 #if (LLVM_VERSION >= 40)
   if(&__archer_get_omp_status) {
-    if(__archer_get_omp_status() == 0 && archer_flags->flush_shadow)
+    if(__archer_get_omp_status() == 0 && archer_flags->flush_shadow) {
       __tsan_flush_memory();
+      ShadowFlushes++;
+    }
   }
 #endif
 
@@ -563,13 +810,25 @@ ompt_tsan_implicit_task(
      case ompt_scope_begin:
         task_data->ptr = new TaskData(ToParallelData(parallel_data));
         TsanHappensAfter(ToParallelData(parallel_data)->GetParallelPtr());
+        if (this_perf) {
+          ToTaskData(task_data)->ProfileRegion = ToParallelData(parallel_data)->ProfileCodePtr;
+          perf_read(this_perf, ToTaskData(task_data)->PerfBegin);
+        }
         COUNT_EVENT2(implicit_task,scope_begin);
+        TRACE_EVENT(implicit_task, ompt_scope_begin, thread_num, task_data->ptr, parallel_data->ptr, NULL);
         break;
      case ompt_scope_end:
         TaskData* Data = ToTaskData(task_data);
+        TRACE_EVENT(implicit_task, ompt_scope_end, thread_num, Data, NULL, NULL);
         assert(Data->freed == 0 && "Implicit task end should only be called once!");
         Data->freed=1;
         assert(Data->RefCount == 1 && "All tasks should have finished at the implicit barrier!");
+        if (this_perf && Data->ProfileRegion) {
+          uint64_t PerfEnd[PERF_COUNTERS];
+          perf_read(this_perf, PerfEnd);
+          profile_add_perf(this_profile_table, profile_parallel, Data->ProfileRegion,
+                           Data->PerfBegin, PerfEnd);
+        }
         delete Data;
         COUNT_EVENT2(implicit_task,scope_end);
         break;
@@ -585,6 +844,7 @@ ompt_tsan_sync_region(
   const void *codeptr_ra)
 {
   TaskData* Data = ToTaskData(task_data);
+  TRACE_EVENT(sync_region, endpoint, kind, Data, NULL, codeptr_ra);
   switch(endpoint)
   {
     case ompt_scope_begin:
@@ -592,6 +852,7 @@ ompt_tsan_sync_region(
       {
         case ompt_sync_region_barrier:
           {
+            PerturbSchedule();
             char BarrierIndex = Data->BarrierIndex;
             TsanHappensBefore(Data->Team->GetBarrierPtr(BarrierIndex));
 
@@ -599,8 +860,11 @@ ompt_tsan_sync_region(
             // 1. reductions performed by the runtime which are guaranteed to be race-free.
             // 2. execution of another task.
             // For the latter case we will re-enable tracking in task_switch.
-            Data->InBarrier = true;
-            TsanIgnoreWritesBegin();
+            // If the runtime reports reductions, we only ignore writes there.
+            if (!hasReductionCallback) {
+              Data->InBarrier = true;
+              TsanIgnoreWritesBegin();
+            }
             COUNT_EVENT3(sync_region,scope_begin,barrier);
             break;
           }
@@ -620,8 +884,10 @@ ompt_tsan_sync_region(
         case ompt_sync_region_barrier:
           {
             // We want to track writes after the barrier again.
-            Data->InBarrier = false;
-            TsanIgnoreWritesEnd();
+            if (Data->InBarrier) {
+              Data->InBarrier = false;
+              TsanIgnoreWritesEnd();
+            }
 
             char BarrierIndex = Data->BarrierIndex;
             // Barrier will end after it has been entered by all threads.
@@ -663,6 +929,36 @@ ompt_tsan_sync_region(
 
 
 
+#if LIBARCHER_OMPT_REDUCTION
+static void
+ompt_tsan_reduction(
+  ompt_sync_region_kind_t kind,
+  ompt_scope_endpoint_t endpoint,
+  ompt_data_t *parallel_data,
+  ompt_data_t *task_data,
+  const void *codeptr_ra)
+{
+  TaskData* Data = ToTaskData(task_data);
+  TRACE_EVENT(reduction, endpoint, kind, Data, NULL, codeptr_ra);
+  switch(endpoint)
+  {
+    case ompt_scope_begin:
+      // Reductions performed by the runtime are guaranteed to be race-free.
+      // Tasks executed while waiting for the other threads are handled in
+      // task_switch.
+      Data->InReduction = true;
+      TsanIgnoreWritesBegin();
+      COUNT_EVENT2(reduction,scope_begin);
+      break;
+    case ompt_scope_end:
+      Data->InReduction = false;
+      TsanIgnoreWritesEnd();
+      COUNT_EVENT2(reduction,scope_end);
+      break;
+  }
+}
+#endif
+
 /// OMPT event callbacks for handling tasks.
 
 static void
@@ -693,16 +989,56 @@ ompt_tsan_task_create(
     Data->Included=true;
     COUNT_EVENT2(task_create,included);
   } else if (type & ompt_task_explicit || type & ompt_task_target) {
-    Data = new TaskData(ToTaskData(parent_task_data));
+    TaskData* Parent = ToTaskData(parent_task_data);
+    Data = new TaskData(Parent);
     new_task_data->ptr = Data;
 
-    // Use the newly created address. We cannot use a single address from the
-    // parent because that would declare wrong relationships with other
-    // sibling tasks that may be created before this task is started!
-    TsanHappensBefore(Data->GetTaskPtr());
-    ToTaskData(parent_task_data)->execution++;
+    if (Parent->InTaskloop) {
+      // The parent did not execute user code since it released its Taskloop
+      // address at the begin of the taskloop. All tasks of the batch can
+      // therefore share this single relationship.
+      Data->Batched = true;
+      Parent->TaskloopPending++;
+    } else {
+      // Use the newly created address. We cannot use a single address from the
+      // parent because that would declare wrong relationships with other
+      // sibling tasks that may be created before this task is started!
+      TsanHappensBefore(Data->GetTaskPtr());
+    }
+    Parent->execution++;
+    if (this_profile_table)
+      Data->ProfileCodePtr = codeptr_ra;
     COUNT_EVENT2(task_create,explicit);
   }
+  TRACE_EVENT(task_create, 0, type, new_task_data->ptr, parent_task_data ? parent_task_data->ptr : NULL, codeptr_ra);
+}
+
+/// Attribute the execution slice of an explicit task that ends with this
+/// task switch to its creation site.
+static void ProfileTaskSchedule(TaskData *FromTask,
+                                ompt_task_status_t prior_task_status,
+                                TaskData *ToTask) {
+  if (!FromTask->ProfileCodePtr && !ToTask->ProfileCodePtr)
+    return;
+  uint64_t Now = profile_now();
+  long Rss = profile_max_rss();
+  uint64_t Perf[PERF_COUNTERS];
+  if (this_perf)
+    perf_read(this_perf, Perf);
+  if (FromTask->ProfileCodePtr) {
+    profile_add(this_profile_table, profile_task, FromTask->ProfileCodePtr,
+                prior_task_status == ompt_task_complete, Now - FromTask->ProfileTime,
+                Rss - FromTask->ProfileRss);
+    if (this_perf)
+      profile_add_perf(this_profile_table, profile_task, FromTask->ProfileCodePtr,
+                       FromTask->PerfBegin, Perf);
+  }
+  if (ToTask->ProfileCodePtr) {
+    ToTask->ProfileTime = Now;
+    ToTask->ProfileRss = Rss;
+    if (this_perf)
+      memcpy(ToTask->PerfBegin, Perf, sizeof(Perf));
+  }
 }
 
 static void
@@ -714,10 +1050,22 @@ ompt_tsan_task_schedule(
   COUNT_EVENT1(task_schedule);
   TaskData* FromTask = ToTaskData(first_task_data);
   TaskData* ToTask = ToTaskData(second_task_data);
-
-  if (ToTask->Included && prior_task_status != ompt_task_complete)
+  TRACE_EVENT(task_schedule, 0, prior_task_status, FromTask, ToTask, NULL);
+  if (this_profile_table)
+    ProfileTaskSchedule(FromTask, prior_task_status, ToTask);
+  if (RecordSchedule || ReplaySchedule)
+    ScheduleTaskSwitch();
+  PerturbSchedule();
+
+  if (ToTask->Included && prior_task_status != ompt_task_complete) {
+    // Included tasks of a taskloop execute user code.
+    if (FromTask->IgnoresWrites())
+      TsanIgnoreWritesEnd();
     return; // No further synchronization for begin included tasks
+  }
   if (FromTask->Included && prior_task_status == ompt_task_complete) {
+    if (ToTask->IgnoresWrites())
+      TsanIgnoreWritesBegin();
     // Just delete the task:
     while (FromTask != nullptr && --FromTask->RefCount == 0) {
       TaskData* Parent = FromTask->Parent;
@@ -735,7 +1083,12 @@ ompt_tsan_task_schedule(
   if (ToTask->execution==0) {
     ToTask->execution++;
   // 1. Task will begin execution after it has been created.
-    TsanHappensAfter(ToTask->GetTaskPtr());
+    if (ToTask->Batched) {
+      TsanHappensAfter(ToTask->Parent->GetTaskloopPtr());
+      // Allow the parent to reuse its Taskloop address for the next batch.
+      ToTask->Parent->TaskloopPending--;
+    } else
+      TsanHappensAfter(ToTask->GetTaskPtr());
     if ( ompt_get_task_memory_info ) {
       if ( !ompt_get_task_memory_info( &(ToTask->PrivateData), &(ToTask->PrivateDataSize), 0) ) {
         ToTask->PrivateData=nullptr; ToTask->PrivateDataSize=0;
@@ -767,9 +1120,9 @@ ompt_tsan_task_schedule(
   //TsanHappensBeforeUC(FromTask->GetTaskPtr());
   TsanHappensBefore(FromTask->GetTaskPtr());
 
-  if (FromTask->InBarrier) {
+  if (FromTask->IgnoresWrites()) {
     // We want to ignore writes in the runtime code during barriers,
-    // but not when executing tasks with user code!
+    // reductions and taskloops, but not when executing tasks with user code!
     TsanIgnoreWritesEnd();
   }
 
@@ -809,8 +1162,9 @@ ompt_tsan_task_schedule(
         FromTask = Parent;
     }
   }
-  if (ToTask->InBarrier) {
-    // We re-enter runtime code which currently performs a barrier.
+  if (ToTask->IgnoresWrites()) {
+    // We re-enter runtime code which currently performs a barrier,
+    // a reduction or creates the tasks of a taskloop.
     TsanIgnoreWritesBegin();
   }
 
@@ -822,6 +1176,7 @@ static void ompt_tsan_task_dependences(
   int ndeps)
 {
   COUNT_EVENT1(task_dependences);
+  TRACE_EVENT(task_dependences, 0, ndeps, task_data->ptr, NULL, NULL);
   if (ndeps > 0) {
     // Copy the data to use it in task_switch and task_end.
     TaskData* Data = ToTaskData(task_data);
@@ -834,7 +1189,63 @@ static void ompt_tsan_task_dependences(
   }
 }
 
+static void ompt_tsan_work(
+  ompt_work_type_t wstype,
+  ompt_scope_endpoint_t endpoint,
+  ompt_data_t *parallel_data,
+  ompt_data_t *task_data,
+  uint64_t count,
+  const void *codeptr_ra)
+{
+  TRACE_EVENT(work, endpoint, wstype, task_data->ptr, parallel_data->ptr, codeptr_ra);
+
+  // Only taskloops are of interest, other worksharing constructs are
+  // synchronized by their barriers.
+  if (wstype != ompt_work_taskloop)
+    return;
+
+  TaskData* Data = ToTaskData(task_data);
+  switch(endpoint)
+  {
+    case ompt_scope_begin:
+      // Tasks of a previous taskloop (with nogroup clause) that did not start
+      // yet still need the old state of the Taskloop address. Fall back to
+      // one relationship per task in that case.
+      if (Data->TaskloopPending == 0) {
+        TsanHappensBefore(Data->GetTaskloopPtr());
+        Data->InTaskloop = true;
+
+        // The runtime copies firstprivate variables into the new tasks
+        // between the creations (task_dup). These writes are made visible
+        // by the creation of each task, so we ignore them.
+        TsanIgnoreWritesBegin();
+      }
+      COUNT_EVENT3(work,scope_begin,taskloop);
+      break;
+    case ompt_scope_end:
+      if (Data->InTaskloop) {
+        Data->InTaskloop = false;
+        TsanIgnoreWritesEnd();
+      }
+      COUNT_EVENT3(work,scope_end,taskloop);
+      break;
+  }
+}
+
 /// OMPT event callbacks for handling locking.
+/// Only registered to replay a schedule: wait until it is our turn to acquire.
+static void ompt_tsan_mutex_acquire(
+  ompt_mutex_kind_t kind,
+  unsigned int hint,
+  unsigned int impl,
+  ompt_wait_id_t wait_id,
+  const void *codeptr_ra)
+{
+  // A failed test_lock doesn't give the turn back, so don't wait again.
+  if (ReplaySchedule && !ScheduleHoldsTurn)
+    ScheduleHoldsTurn = schedule_replay_wait(SCHEDULE_LOCK, ScheduleThread());
+}
+
 static void ompt_tsan_mutex_acquired(
   ompt_mutex_kind_t kind,
   ompt_wait_id_t wait_id,
@@ -875,6 +1286,15 @@ static void ompt_tsan_mutex_acquired(
   }
 
   TsanHappensAfter(ToWaitPtr(wait_id));
+  TRACE_EVENT(mutex_acquired, 0, kind, wait_id, 0, codeptr_ra);
+  // Delay inside the critical section so that other threads queue up.
+  PerturbSchedule();
+  if (RecordSchedule)
+    schedule_record(SCHEDULE_LOCK, ScheduleThread());
+  if (ScheduleHoldsTurn) {
+    ScheduleHoldsTurn = false;
+    schedule_replay_advance();
+  }
 }
 
 static void ompt_tsan_mutex_released(
@@ -904,6 +1324,7 @@ static void ompt_tsan_mutex_released(
         COUNT_EVENT2(mutex_released, default);
         break;
     }
+  TRACE_EVENT(mutex_released, 0, kind, wait_id, 0, codeptr_ra);
   TsanHappensBefore(ToWaitPtr(wait_id));
 
   {
@@ -915,9 +1336,352 @@ static void ompt_tsan_mutex_released(
   }
 }
 
+/// Multiplexing of a second OMPT tool named by ARCHER_TOOL_LIBRARIES.
+///
+/// Archer owns the ompt_data_t of threads, parallel regions and tasks. The
+/// client tool gets its own ompt_data_t stored in the Archer data, which is
+/// passed to the client callbacks and returned by the inquiry functions.
+/// Without a client tool the Archer callbacks are registered directly, so
+/// there is no dispatch cost.
+
+static ompt_start_tool_result_t *ClientTool;
+static ompt_function_lookup_t RuntimeLookup;
+static ompt_set_callback_t RuntimeSetCallback;
+static ompt_get_task_info_t RuntimeGetTaskInfo;
+static ompt_callback_t ClientCallbacks[64];
+__thread ompt_data_t ClientThreadData;
+
+#define CLIENT_CALLBACK_T(event, type)                                         \
+  ((ompt_callback_##type##_t)ClientCallbacks[ompt_callback_##event])
+
+#define CLIENT_CALLBACK(event) CLIENT_CALLBACK_T(event, event)
+
+static ompt_data_t *ClientParallel(ompt_data_t *parallel_data) {
+  if (parallel_data == nullptr || parallel_data->ptr == nullptr)
+    return parallel_data;
+  return &ToParallelData(parallel_data)->ClientData;
+}
+
+static ompt_data_t *ClientTask(ompt_data_t *task_data) {
+  if (task_data == nullptr || task_data->ptr == nullptr)
+    return task_data;
+  return &ToTaskData(task_data)->ClientData;
+}
+
+// Begin events call Archer first to create the data, end events call the
+// client first because Archer may release the data.
+
+static void ompt_multiplex_thread_begin(ompt_thread_type_t thread_type,
+                                        ompt_data_t *thread_data) {
+  ompt_tsan_thread_begin(thread_type, thread_data);
+  if (CLIENT_CALLBACK(thread_begin))
+    CLIENT_CALLBACK(thread_begin)(thread_type, &ClientThreadData);
+}
+
+static void ompt_multiplex_thread_end(ompt_data_t *thread_data) {
+  if (CLIENT_CALLBACK(thread_end))
+    CLIENT_CALLBACK(thread_end)(&ClientThreadData);
+}
+
+static void ompt_multiplex_parallel_begin(
+    ompt_data_t *parent_task_data, const ompt_frame_t *parent_task_frame,
+    ompt_data_t *parallel_data, uint32_t requested_team_size,
+    ompt_invoker_t invoker, const void *codeptr_ra) {
+  ompt_tsan_parallel_begin(parent_task_data, parent_task_frame, parallel_data,
+                           requested_team_size, invoker, codeptr_ra);
+  // The data may be recycled from the previous region.
+  ToParallelData(parallel_data)->ClientData.value = 0;
+  if (CLIENT_CALLBACK(parallel_begin))
+    CLIENT_CALLBACK(parallel_begin)(ClientTask(parent_task_data), parent_task_frame,
+                                    ClientParallel(parallel_data),
+                                    requested_team_size, invoker, codeptr_ra);
+}
+
+static void ompt_multiplex_parallel_end(ompt_data_t *parallel_data,
+                                        ompt_data_t *task_data,
+                                        ompt_invoker_t invoker,
+                                        const void *codeptr_ra) {
+  if (CLIENT_CALLBACK(parallel_end))
+    CLIENT_CALLBACK(parallel_end)(ClientParallel(parallel_data),
+                                  ClientTask(task_data), invoker, codeptr_ra);
+  ompt_tsan_parallel_end(parallel_data, task_data, invoker, codeptr_ra);
+}
+
+static void ompt_multiplex_implicit_task(ompt_scope_endpoint_t endpoint,
+                                         ompt_data_t *parallel_data,
+                                         ompt_data_t *task_data,
+                                         unsigned int team_size,
+                                         unsigned int thread_num) {
+  if (endpoint == ompt_scope_begin)
+    ompt_tsan_implicit_task(endpoint, parallel_data, task_data, team_size, thread_num);
+  if (CLIENT_CALLBACK(implicit_task))
+    CLIENT_CALLBACK(implicit_task)(endpoint, ClientParallel(parallel_data),
+                                   ClientTask(task_data), team_size, thread_num);
+  if (endpoint == ompt_scope_end)
+    ompt_tsan_implicit_task(endpoint, parallel_data, task_data, team_size, thread_num);
+}
+
+static void ompt_multiplex_sync_region(ompt_sync_region_kind_t kind,
+                                       ompt_scope_endpoint_t endpoint,
+                                       ompt_data_t *parallel_data,
+                                       ompt_data_t *task_data,
+                                       const void *codeptr_ra) {
+  ompt_tsan_sync_region(kind, endpoint, parallel_data, task_data, codeptr_ra);
+  if (CLIENT_CALLBACK(sync_region))
+    CLIENT_CALLBACK(sync_region)(kind, endpoint, ClientParallel(parallel_data),
+                                 ClientTask(task_data), codeptr_ra);
+}
+
+static void ompt_multiplex_sync_region_wait(ompt_sync_region_kind_t kind,
+                                            ompt_scope_endpoint_t endpoint,
+                                            ompt_data_t *parallel_data,
+                                            ompt_data_t *task_data,
+                                            const void *codeptr_ra) {
+  if (CLIENT_CALLBACK_T(sync_region_wait, sync_region))
+    CLIENT_CALLBACK_T(sync_region_wait, sync_region)(kind, endpoint, ClientParallel(parallel_data),
+                                      ClientTask(task_data), codeptr_ra);
+}
+
+#if LIBARCHER_OMPT_REDUCTION
+static void ompt_multiplex_reduction(ompt_sync_region_kind_t kind,
+                                     ompt_scope_endpoint_t endpoint,
+                                     ompt_data_t *parallel_data,
+                                     ompt_data_t *task_data,
+                                     const void *codeptr_ra) {
+  ompt_tsan_reduction(kind, endpoint, parallel_data, task_data, codeptr_ra);
+  if (CLIENT_CALLBACK_T(reduction, sync_region))
+    CLIENT_CALLBACK_T(reduction, sync_region)(kind, endpoint, ClientParallel(parallel_data),
+                               ClientTask(task_data), codeptr_ra);
+}
+#endif
+
+static void ompt_multiplex_task_create(ompt_data_t *parent_task_data,
+                                       const ompt_frame_t *parent_frame,
+                                       ompt_data_t *new_task_data, int type,
+                                       int has_dependences,
+                                       const void *codeptr_ra) {
+  ompt_tsan_task_create(parent_task_data, parent_frame, new_task_data, type,
+                        has_dependences, codeptr_ra);
+  if (type & ompt_task_initial) {
+    // Archer created the data of the initial parallel region.
+    ompt_data_t *parallel_data;
+    int team_size;
+    ompt_get_parallel_info(0, &parallel_data, &team_size);
+    ToParallelData(parallel_data)->ClientData.value = 0;
+  }
+  if (CLIENT_CALLBACK(task_create))
+    CLIENT_CALLBACK(task_create)(ClientTask(parent_task_data), parent_frame,
+                                 ClientTask(new_task_data), type,
+                                 has_dependences, codeptr_ra);
+}
+
+static void ompt_multiplex_task_schedule(ompt_data_t *first_task_data,
+                                         ompt_task_status_t prior_task_status,
+                                         ompt_data_t *second_task_data) {
+  if (CLIENT_CALLBACK(task_schedule))
+    CLIENT_CALLBACK(task_schedule)(ClientTask(first_task_data), prior_task_status,
+                                   ClientTask(second_task_data));
+  ompt_tsan_task_schedule(first_task_data, prior_task_status, second_task_data);
+}
+
+static void ompt_multiplex_task_dependences(ompt_data_t *task_data,
+                                            const ompt_task_dependence_t *deps,
+                                            int ndeps) {
+  ompt_tsan_task_dependences(task_data, deps, ndeps);
+  if (CLIENT_CALLBACK(task_dependences))
+    CLIENT_CALLBACK(task_dependences)(ClientTask(task_data), deps, ndeps);
+}
+
+static void ompt_multiplex_task_dependence(ompt_data_t *first_task_data,
+                                           ompt_data_t *second_task_data) {
+  if (CLIENT_CALLBACK(task_dependence))
+    CLIENT_CALLBACK(task_dependence)(ClientTask(first_task_data),
+                                     ClientTask(second_task_data));
+}
+
+static void ompt_multiplex_work(ompt_work_type_t wstype,
+                                ompt_scope_endpoint_t endpoint,
+                                ompt_data_t *parallel_data,
+                                ompt_data_t *task_data, uint64_t count,
+                                const void *codeptr_ra) {
+  ompt_tsan_work(wstype, endpoint, parallel_data, task_data, count, codeptr_ra);
+  if (CLIENT_CALLBACK(work))
+    CLIENT_CALLBACK(work)(wstype, endpoint, ClientParallel(parallel_data),
+                          ClientTask(task_data), count, codeptr_ra);
+}
+
+static void ompt_multiplex_master(ompt_scope_endpoint_t endpoint,
+                                  ompt_data_t *parallel_data,
+                                  ompt_data_t *task_data,
+                                  const void *codeptr_ra) {
+  if (CLIENT_CALLBACK(master))
+    CLIENT_CALLBACK(master)(endpoint, ClientParallel(parallel_data),
+                            ClientTask(task_data), codeptr_ra);
+}
+
+static void ompt_multiplex_mutex_acquire(ompt_mutex_kind_t kind,
+                                         unsigned int hint, unsigned int impl,
+                                         ompt_wait_id_t wait_id,
+                                         const void *codeptr_ra) {
+  ompt_tsan_mutex_acquire(kind, hint, impl, wait_id, codeptr_ra);
+  if (CLIENT_CALLBACK(mutex_acquire))
+    CLIENT_CALLBACK(mutex_acquire)(kind, hint, impl, wait_id, codeptr_ra);
+}
+
+static void ompt_multiplex_mutex_acquired(ompt_mutex_kind_t kind,
+                                          ompt_wait_id_t wait_id,
+                                          const void *codeptr_ra) {
+  ompt_tsan_mutex_acquired(kind, wait_id, codeptr_ra);
+  if (CLIENT_CALLBACK_T(mutex_acquired, mutex))
+    CLIENT_CALLBACK_T(mutex_acquired, mutex)(kind, wait_id, codeptr_ra);
+}
+
+static void ompt_multiplex_mutex_released(ompt_mutex_kind_t kind,
+                                          ompt_wait_id_t wait_id,
+                                          const void *codeptr_ra) {
+  if (CLIENT_CALLBACK_T(mutex_released, mutex))
+    CLIENT_CALLBACK_T(mutex_released, mutex)(kind, wait_id, codeptr_ra);
+  ompt_tsan_mutex_released(kind, wait_id, codeptr_ra);
+}
+
+static void ompt_multiplex_flush(ompt_data_t *thread_data,
+                                 const void *codeptr_ra) {
+  if (CLIENT_CALLBACK(flush))
+    CLIENT_CALLBACK(flush)(&ClientThreadData, codeptr_ra);
+}
+
+static void ompt_multiplex_cancel(ompt_data_t *task_data, int flags,
+                                  const void *codeptr_ra) {
+  if (CLIENT_CALLBACK(cancel))
+    CLIENT_CALLBACK(cancel)(ClientTask(task_data), flags, codeptr_ra);
+}
+
+/// Inquiry functions of the client tool.
+
+static int ompt_multiplex_set_callback(ompt_callbacks_t event,
+                                       ompt_callback_t callback) {
+  ompt_callback_t Wrapper;
+  switch (event) {
+#define MULTIPLEX_EVENT(name)                                                  \
+  case ompt_callback_##name:                                                   \
+    Wrapper = (ompt_callback_t)&ompt_multiplex_##name;                         \
+    break;
+    MULTIPLEX_EVENT(thread_begin)
+    MULTIPLEX_EVENT(thread_end)
+    MULTIPLEX_EVENT(parallel_begin)
+    MULTIPLEX_EVENT(parallel_end)
+    MULTIPLEX_EVENT(implicit_task)
+    MULTIPLEX_EVENT(sync_region)
+    MULTIPLEX_EVENT(sync_region_wait)
+#if LIBARCHER_OMPT_REDUCTION
+    MULTIPLEX_EVENT(reduction)
+#endif
+    MULTIPLEX_EVENT(task_create)
+    MULTIPLEX_EVENT(task_schedule)
+    MULTIPLEX_EVENT(task_dependences)
+    MULTIPLEX_EVENT(task_dependence)
+    MULTIPLEX_EVENT(work)
+    MULTIPLEX_EVENT(master)
+    MULTIPLEX_EVENT(mutex_acquire)
+    MULTIPLEX_EVENT(mutex_acquired)
+    MULTIPLEX_EVENT(mutex_released)
+    MULTIPLEX_EVENT(flush)
+    MULTIPLEX_EVENT(cancel)
+#undef MULTIPLEX_EVENT
+  // Events that Archer does not use, e.g. lock_init, idle or the target
+  // and device events, are passed through.
+  default:
+    return RuntimeSetCallback(event, callback);
+  }
+  ClientCallbacks[event] = callback;
+  int ret = RuntimeSetCallback(event, Wrapper);
+  if (ret == ompt_set_error || ret == ompt_set_never)
+    ClientCallbacks[event] = nullptr;
+  return ret;
+}
+
+static int ompt_multiplex_get_callback(ompt_callbacks_t event,
+                                       ompt_callback_t *callback) {
+  if (event < 0 || event >= 64 || !ClientCallbacks[event])
+    return 0;
+  *callback = ClientCallbacks[event];
+  return 1;
+}
+
+static ompt_data_t *ompt_multiplex_get_thread_data() {
+  return &ClientThreadData;
+}
+
+static int ompt_multiplex_get_parallel_info(int ancestor_level,
+                                            ompt_data_t **parallel_data,
+                                            int *team_size) {
+  int ret = ompt_get_parallel_info(ancestor_level, parallel_data, team_size);
+  if (ret && parallel_data)
+    *parallel_data = ClientParallel(*parallel_data);
+  return ret;
+}
+
+static int ompt_multiplex_get_task_info(int ancestor_level, int *flags,
+                                        ompt_data_t **task_data,
+                                        ompt_frame_t **task_frame,
+                                        ompt_data_t **parallel_data,
+                                        int *thread_num) {
+  int ret = RuntimeGetTaskInfo(ancestor_level, flags, task_data, task_frame,
+                               parallel_data, thread_num);
+  if (ret && task_data)
+    *task_data = ClientTask(*task_data);
+  if (ret && parallel_data)
+    *parallel_data = ClientParallel(*parallel_data);
+  return ret;
+}
+
+static ompt_interface_fn_t ompt_multiplex_lookup(const char *name) {
+  if (!strcmp(name, "ompt_set_callback"))
+    return (ompt_interface_fn_t)&ompt_multiplex_set_callback;
+  if (!strcmp(name, "ompt_get_callback"))
+    return (ompt_interface_fn_t)&ompt_multiplex_get_callback;
+  if (!strcmp(name, "ompt_get_thread_data"))
+    return (ompt_interface_fn_t)&ompt_multiplex_get_thread_data;
+  if (!strcmp(name, "ompt_get_parallel_info"))
+    return (ompt_interface_fn_t)&ompt_multiplex_get_parallel_info;
+  if (!strcmp(name, "ompt_get_task_info"))
+    return RuntimeGetTaskInfo ? (ompt_interface_fn_t)&ompt_multiplex_get_task_info
+                              : nullptr;
+  return RuntimeLookup(name);
+}
+
+/// Load the first tool in the colon separated list ARCHER_TOOL_LIBRARIES that
+/// wants to be activated.
+static ompt_start_tool_result_t *LoadClientTool(unsigned int omp_version,
+                                                const char *runtime_version) {
+  const char *libraries = getenv("ARCHER_TOOL_LIBRARIES");
+  if (!libraries)
+    return nullptr;
+  std::istringstream iss(libraries);
+  std::string library;
+  while (std::getline(iss, library, ':')) {
+    void *handle = dlopen(library.c_str(), RTLD_LAZY);
+    if (!handle) {
+      fprintf(stderr, "Archer: could not load tool %s: %s\n", library.c_str(), dlerror());
+      continue;
+    }
+    ompt_start_tool_result_t *(*start_tool)(unsigned int, const char *) =
+        (ompt_start_tool_result_t * (*)(unsigned int, const char *))
+            dlsym(handle, "ompt_start_tool");
+    ompt_start_tool_result_t *result =
+        start_tool ? start_tool(omp_version, runtime_version) : nullptr;
+    if (result)
+      return result;
+    dlclose(handle);
+  }
+  return nullptr;
+}
+
 #define SET_CALLBACK_T(event, type)                           \
 do{                                                           \
   ompt_callback_##type##_t tsan_##event = &ompt_tsan_##event; \
+  if (ClientTool)                                             \
+    tsan_##event = &ompt_multiplex_##event;                   \
   int ret = ompt_set_callback(ompt_callback_##event,          \
       (ompt_callback_t) tsan_##event);                        \
   if (ret != ompt_set_always)                                 \
@@ -938,6 +1702,13 @@ static int ompt_tsan_initialize(
   if(archer_flags->print_ompt_counters)
     all_counter = new callback_counter_t[MAX_THREADS];
 
+  if(archer_flags->perturb_schedule) {
+    PerturbSeed = archer_flags->perturb_seed;
+    if (!PerturbSeed)
+      PerturbSeed = (unsigned)time(NULL) ^ ((unsigned)getpid() << 16);
+    PrintPerturbSeed();
+  }
+
   ompt_set_callback_t ompt_set_callback = (ompt_set_callback_t) lookup("ompt_set_callback");
   if (ompt_set_callback == NULL) {
     std::cerr << "Could not set callback, exiting..." << std::endl;
@@ -947,6 +1718,9 @@ static int ompt_tsan_initialize(
   ompt_get_thread_data = (ompt_get_thread_data_t) lookup("ompt_get_thread_data");
   ompt_get_task_memory_info = nullptr;
   ompt_get_task_memory_info = (ompt_get_task_memory_t) lookup("ompt_get_task_memory_info");
+  RuntimeLookup = lookup;
+  RuntimeSetCallback = ompt_set_callback;
+  RuntimeGetTaskInfo = (ompt_get_task_info_t) lookup("ompt_get_task_info");
 
   if (ompt_get_parallel_info == NULL) {
     fprintf(stderr, "Could not get inquiry function 'ompt_get_parallel_info', exiting...\n");
@@ -963,20 +1737,64 @@ static int ompt_tsan_initialize(
   SET_CALLBACK(task_create);
   SET_CALLBACK(task_schedule);
   SET_CALLBACK(task_dependences);
+  SET_CALLBACK(work);
+#if LIBARCHER_OMPT_REDUCTION
+  // Only rely on reductions if the runtime reports all of them.
+  hasReductionCallback = (ompt_set_callback(ompt_callback_reduction,
+      ClientTool ? (ompt_callback_t) &ompt_multiplex_reduction
+                 : (ompt_callback_t) &ompt_tsan_reduction) == ompt_set_always);
+#endif
 
   SET_CALLBACK_T(mutex_acquired, mutex);
   SET_CALLBACK_T(mutex_released, mutex);
+
+  if (archer_flags->record_schedule) {
+    schedule_record_open();
+    RecordSchedule = true;
+  }
+  if (archer_flags->replay_schedule &&
+      schedule_replay_open(archer_flags->replay_schedule)) {
+    ReplaySchedule = true;
+    SET_CALLBACK(mutex_acquire);
+  }
+
+  if(archer_flags->memory_timeline > 0)
+    timeline_start(archer_flags->memory_timeline, TimelineSample);
+
+  // The client registers its callbacks through ompt_multiplex_set_callback.
+  if (ClientTool &&
+      !ClientTool->initialize(&ompt_multiplex_lookup, &ClientTool->tool_data))
+    ClientTool->finalize = nullptr;
   return 1; // success
 }
 
 
 static void ompt_tsan_finalize(ompt_data_t *tool_data)
 {
+  if (ClientTool && ClientTool->finalize)
+    ClientTool->finalize(&ClientTool->tool_data);
+
+  if(archer_flags->memory_timeline > 0)
+    timeline_stop();
+
   if(archer_flags->print_ompt_counters) {
     print_callbacks(all_counter);
     delete[] all_counter;
   }
 
+  if(archer_flags->trace_events)
+    trace_flush_all();
+
+  if(RecordSchedule || ReplaySchedule)
+    schedule_close();
+
+  if(archer_flags->print_region_profile || archer_flags->perf_counters)
+    print_profile();
+
+  // Repeat the seed after any race reports that were printed during the run.
+  if(archer_flags->perturb_schedule)
+    PrintPerturbSeed();
+
   if(archer_flags->print_max_rss) {
     struct rusage end;
     getrusage(RUSAGE_SELF, &end);
@@ -994,8 +1812,9 @@ ompt_start_tool_result_t* ompt_start_tool(
   static ompt_start_tool_result_t ompt_start_tool_result = {&ompt_tsan_initialize,&ompt_tsan_finalize, {0}};
   runOnTsan=1;
   RunningOnValgrind();
+  ClientTool = LoadClientTool(omp_version, runtime_version);
   if (!runOnTsan) // if we are not running on TSAN, give a different tool the chance to be loaded
-    return NULL;
+    return ClientTool;
 
   return &ompt_start_tool_result;
 }
@@ -0,0 +1,122 @@
+/*
+Copyright (c) 2015-2019, Lawrence Livermore National Security, LLC.
+
+Produced at the Lawrence Livermore National Laboratory
+
+Written by Simone Atzeni (simone@cs.utah.edu), Joachim Protze
+(joachim.protze@tu-dresden.de), Jonas Hahnfeld
+(hahnfeld@itc.rwth-aachen.de), Ganesh Gopalakrishnan, Zvonimir
+Rakamaric, Dong H. Ahn, Gregory L. Lee, Ignacio Laguna, and Martin
+Schulz.
+
+LLNL-CODE-773957
+
+All rights reserved.
+
+This file is part of Archer. For details, see
+https://pruners.github.io/archer. Please also read
+https://github.com/PRUNERS/archer/blob/master/LICENSE.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+   Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the disclaimer below.
+
+   Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the disclaimer (as noted below)
+   in the documentation and/or other materials provided with the
+   distribution.
+
+   Neither the name of the LLNS/LLNL nor the names of its contributors
+   may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LAWRENCE
+LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "perf.h"
+
+#include <atomic>
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+__thread perf_thread_t *this_perf;
+
+static const struct {
+    uint32_t type;
+    uint64_t config;
+    const char *name;
+} perf_events[PERF_COUNTERS] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "cache-misses"},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, "page-faults"},
+};
+
+static std::atomic<int> perf_opened_mask;
+static std::atomic<int> perf_warned;
+
+perf_thread_t *perf_open(){
+    perf_thread_t *perf = new perf_thread_t;
+    perf->leader = -1;
+    int nr = 0;
+    for (int i = 0; i < PERF_COUNTERS; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = perf_events[i].type;
+        attr.config = perf_events[i].config;
+        attr.read_format = PERF_FORMAT_GROUP;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.disabled = (perf->leader == -1);
+        // Count the calling thread on any cpu.
+        int fd = syscall(__NR_perf_event_open, &attr, 0, -1, perf->leader, 0);
+        if (fd < 0) {
+            perf->index[i] = -1;
+            continue;
+        }
+        if (perf->leader == -1)
+            perf->leader = fd;
+        perf->index[i] = nr++;
+        perf_opened_mask |= 1 << i;
+    }
+    if (perf->leader == -1) {
+        if (!perf_warned.exchange(1))
+            fprintf(stderr, "Archer: could not open any perf counter (perf_event_paranoid?)\n");
+        delete perf;
+        return NULL;
+    }
+    ioctl(perf->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    return perf;
+}
+
+void perf_read(perf_thread_t *perf, uint64_t values[PERF_COUNTERS]){
+    uint64_t data[1 + PERF_COUNTERS];
+    if (read(perf->leader, data, sizeof(data)) < (ssize_t)sizeof(uint64_t))
+        data[0] = 0;
+    for (int i = 0; i < PERF_COUNTERS; i++)
+        values[i] = (perf->index[i] >= 0 && (uint64_t)perf->index[i] < data[0])
+                        ? data[1 + perf->index[i]] : 0;
+}
+
+const char *perf_counter_name(int i){
+    return (perf_opened_mask & (1 << i)) ? perf_events[i].name : NULL;
+}
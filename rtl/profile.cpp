@@ -0,0 +1,169 @@
+/*
+Copyright (c) 2015-2019, Lawrence Livermore National Security, LLC.
+
+Produced at the Lawrence Livermore National Laboratory
+
+Written by Simone Atzeni (simone@cs.utah.edu), Joachim Protze
+(joachim.protze@tu-dresden.de), Jonas Hahnfeld
+(hahnfeld@itc.rwth-aachen.de), Ganesh Gopalakrishnan, Zvonimir
+Rakamaric, Dong H. Ahn, Gregory L. Lee, Ignacio Laguna, and Martin
+Schulz.
+
+LLNL-CODE-773957
+
+All rights reserved.
+
+This file is part of Archer. For details, see
+https://pruners.github.io/archer. Please also read
+https://github.com/PRUNERS/archer/blob/master/LICENSE.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+   Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the disclaimer below.
+
+   Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the disclaimer (as noted below)
+   in the documentation and/or other materials provided with the
+   distribution.
+
+   Neither the name of the LLNS/LLNL nor the names of its contributors
+   may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LAWRENCE
+LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "profile.h"
+#include "perf.h"
+
+#include <algorithm>
+#include <dlfcn.h>
+#include <inttypes.h>
+#include <mutex>
+#include <stdio.h>
+#include <unordered_map>
+#include <vector>
+
+extern "C" {
+  // Provided by the sanitizer runtime, symbolizes with the debug info of
+  // the binary.
+  void __attribute__((weak)) __sanitizer_symbolize_pc(void *pc, const char *fmt,
+                                                      char *out_buf, size_t out_buf_size);
+}
+
+typedef struct {
+    uint64_t count;
+    uint64_t time;				// ns
+    long rss;					// KBytes
+    uint64_t perf[PERF_COUNTERS];		// see perf.h
+} profile_entry_t;
+
+struct profile_table_t {
+    std::unordered_map<const void *, profile_entry_t> entries[2];
+};
+
+__thread profile_table_t *this_profile_table;
+
+static std::vector<profile_table_t *> all_profile_tables;
+static std::mutex profile_tables_mutex;
+
+profile_table_t *profile_open(){
+    profile_table_t *table = new profile_table_t;
+    profile_tables_mutex.lock();
+    all_profile_tables.push_back(table);
+    profile_tables_mutex.unlock();
+    return table;
+}
+
+void profile_add(profile_table_t *table, profile_kind_t kind, const void *codeptr,
+                 uint64_t count, uint64_t time, long rss){
+    profile_entry_t &entry = table->entries[kind][codeptr];
+    entry.count += count;
+    entry.time += time;
+    entry.rss += rss;
+}
+
+void profile_add_perf(profile_table_t *table, profile_kind_t kind, const void *codeptr,
+                      const uint64_t *begin, const uint64_t *end){
+    profile_entry_t &entry = table->entries[kind][codeptr];
+    for (int i = 0; i < PERF_COUNTERS; i++)
+        entry.perf[i] += end[i] - begin[i];
+}
+
+void profile_symbolize(const void *codeptr, char *buf, size_t size){
+    if (&__sanitizer_symbolize_pc) {
+        __sanitizer_symbolize_pc((void *)codeptr, "%f %L", buf, size);
+        return;
+    }
+    Dl_info info;
+    if (codeptr && dladdr(codeptr, &info) && info.dli_fname)
+        snprintf(buf, size, "(%s+0x%" PRIxPTR ")", info.dli_fname,
+                 (uintptr_t)codeptr - (uintptr_t)info.dli_fbase);
+    else
+        snprintf(buf, size, "%p", codeptr);
+}
+
+void print_profile(){
+    struct row_t {
+        profile_kind_t kind;
+        const void *codeptr;
+        profile_entry_t entry;
+    };
+    std::unordered_map<const void *, profile_entry_t> merged[2];
+    profile_tables_mutex.lock();
+    for (profile_table_t *table : all_profile_tables)
+        for (int kind = 0; kind < 2; kind++)
+            for (auto &it : table->entries[kind]) {
+                profile_entry_t &entry = merged[kind][it.first];
+                entry.count += it.second.count;
+                entry.time += it.second.time;
+                entry.rss += it.second.rss;
+                for (int i = 0; i < PERF_COUNTERS; i++)
+                    entry.perf[i] += it.second.perf[i];
+            }
+    profile_tables_mutex.unlock();
+
+    std::vector<row_t> rows;
+    for (int kind = 0; kind < 2; kind++)
+        for (auto &it : merged[kind])
+            rows.push_back({(profile_kind_t)kind, it.first, it.second});
+    std::sort(rows.begin(), rows.end(), [](const row_t &a, const row_t &b) {
+        return a.entry.time > b.entry.time;
+    });
+
+    printf("Region profile (time of parallel regions on the master thread, time of tasks summed over all threads):\n");
+    if (perf_counter_name(PERF_COUNTERS - 1))
+        printf("Counters of parallel regions are summed over their implicit tasks.\n");
+    printf("--------------------------------------\n");
+    printf("%4s %-8s %10s %12s %12s", "rank", "kind", "count", "time[ms]", "RSS+[KB]");
+    for (int i = 0; i < PERF_COUNTERS; i++)
+        if (perf_counter_name(i))
+            printf(" %14s", perf_counter_name(i));
+    printf("  %s\n", "location");
+    char location[1024];
+    int rank = 1;
+    for (const row_t &row : rows) {
+        profile_symbolize(row.codeptr, location, sizeof(location));
+        printf("%4d %-8s %10" PRIu64 " %12.3f %12ld", rank++,
+               row.kind == profile_parallel ? "parallel" : "task", row.entry.count,
+               row.entry.time / 1e6, row.entry.rss);
+        for (int i = 0; i < PERF_COUNTERS; i++)
+            if (perf_counter_name(i))
+                printf(" %14" PRIu64, row.entry.perf[i]);
+        printf("  %s\n", location);
+    }
+}
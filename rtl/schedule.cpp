@@ -0,0 +1,155 @@
+/*
+Copyright (c) 2015-2019, Lawrence Livermore National Security, LLC.
+
+Produced at the Lawrence Livermore National Laboratory
+
+Written by Simone Atzeni (simone@cs.utah.edu), Joachim Protze
+(joachim.protze@tu-dresden.de), Jonas Hahnfeld
+(hahnfeld@itc.rwth-aachen.de), Ganesh Gopalakrishnan, Zvonimir
+Rakamaric, Dong H. Ahn, Gregory L. Lee, Ignacio Laguna, and Martin
+Schulz.
+
+LLNL-CODE-773957
+
+All rights reserved.
+
+This file is part of Archer. For details, see
+https://pruners.github.io/archer. Please also read
+https://github.com/PRUNERS/archer/blob/master/LICENSE.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+   Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the disclaimer below.
+
+   Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the disclaimer (as noted below)
+   in the documentation and/or other materials provided with the
+   distribution.
+
+   Neither the name of the LLNS/LLNL nor the names of its contributors
+   may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LAWRENCE
+LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "schedule.h"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <vector>
+
+// Time a thread waits for its turn before the replay is given up. Threads
+// may compute for a long time between two events, so this is generous.
+#define SCHEDULE_REPLAY_TIMEOUT_S 10
+
+static FILE *schedule_file;
+static std::mutex schedule_mutex;
+
+static std::vector<uint64_t> schedule_log;
+static std::atomic<size_t> schedule_next;
+static std::atomic<bool> schedule_diverged;
+static bool schedule_replaying;
+
+static inline uint64_t schedule_entry(char kind, int thread){
+    return (uint64_t)(uint32_t)thread << 8 | (unsigned char)kind;
+}
+
+void schedule_record_open(){
+    char filename[64];
+    snprintf(filename, sizeof(filename), "archer_schedule.%d.log", getpid());
+    schedule_file = fopen(filename, "w");
+    if (!schedule_file) {
+        fprintf(stderr, "Archer: could not open schedule log %s\n", filename);
+        return;
+    }
+    fprintf(stderr, "Archer: recording the schedule to %s "
+            "(replay with ARCHER_OPTIONS=\"replay_schedule=%d\")\n",
+            filename, getpid());
+}
+
+void schedule_record(char kind, int thread){
+    if (!schedule_file)
+        return;
+    std::lock_guard<std::mutex> lock(schedule_mutex);
+    fprintf(schedule_file, "%c %d\n", kind, thread);
+}
+
+bool schedule_replay_open(int pid){
+    char filename[64];
+    snprintf(filename, sizeof(filename), "archer_schedule.%d.log", pid);
+    FILE *file = fopen(filename, "r");
+    if (!file) {
+        fprintf(stderr, "Archer: could not open schedule log %s for replay\n", filename);
+        return false;
+    }
+    char kind;
+    int thread;
+    while (fscanf(file, " %c %d", &kind, &thread) == 2)
+        schedule_log.push_back(schedule_entry(kind, thread));
+    fclose(file);
+    schedule_replaying = true;
+    fprintf(stderr, "Archer: replaying %zu events from %s\n", schedule_log.size(), filename);
+    return true;
+}
+
+bool schedule_replay_wait(char kind, int thread){
+    uint64_t entry = schedule_entry(kind, thread);
+    std::chrono::steady_clock::time_point start;
+    unsigned spins = 0;
+    while (!schedule_diverged.load(std::memory_order_relaxed)) {
+        size_t next = schedule_next.load(std::memory_order_acquire);
+        if (next >= schedule_log.size())
+            return false;
+        if (schedule_log[next] == entry)
+            return true;
+        // Only look at the clock every now and then.
+        if (++spins % 1024 == 0) {
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            if (spins == 1024)
+                start = now;
+            else if (now - start > std::chrono::seconds(SCHEDULE_REPLAY_TIMEOUT_S)) {
+                if (!schedule_diverged.exchange(true))
+                    fprintf(stderr, "Archer: schedule replay diverged at event %zu "
+                            "(thread %d waits for '%c'), continuing without replay\n",
+                            next, thread, kind);
+                return false;
+            }
+        }
+        sched_yield();
+    }
+    return false;
+}
+
+void schedule_replay_advance(){
+    schedule_next.fetch_add(1, std::memory_order_release);
+}
+
+void schedule_close(){
+    if (schedule_file) {
+        fclose(schedule_file);
+        schedule_file = NULL;
+    }
+    if (schedule_replaying && !schedule_diverged)
+        fprintf(stderr, "Archer: replayed %zu of %zu events\n",
+                schedule_next.load(), schedule_log.size());
+}
@@ -0,0 +1,194 @@
+/*
+Copyright (c) 2015-2019, Lawrence Livermore National Security, LLC.
+
+Produced at the Lawrence Livermore National Laboratory
+
+Written by Simone Atzeni (simone@cs.utah.edu), Joachim Protze
+(joachim.protze@tu-dresden.de), Jonas Hahnfeld
+(hahnfeld@itc.rwth-aachen.de), Ganesh Gopalakrishnan, Zvonimir
+Rakamaric, Dong H. Ahn, Gregory L. Lee, Ignacio Laguna, and Martin
+Schulz.
+
+LLNL-CODE-773957
+
+All rights reserved.
+
+This file is part of Archer. For details, see
+https://pruners.github.io/archer. Please also read
+https://github.com/PRUNERS/archer/blob/master/LICENSE.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+   Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the disclaimer below.
+
+   Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the disclaimer (as noted below)
+   in the documentation and/or other materials provided with the
+   distribution.
+
+   Neither the name of the LLNS/LLNL nor the names of its contributors
+   may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LAWRENCE
+LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "sites.h"
+
+#include <algorithm>
+#include <inttypes.h>
+#include <mutex>
+#include <stdio.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+typedef struct {
+    uint64_t count;
+    uintptr_t begin;				// address range accessed by this thread
+    uintptr_t end;
+} site_entry_t;
+
+struct site_table_t {
+    std::unordered_map<const site_t *, site_entry_t> entries;
+};
+
+static __thread site_table_t *this_site_table;
+
+// Never freed, the tables are read in a destructor after the static
+// objects of the library are gone.
+static std::vector<site_table_t *> *all_site_tables;
+static std::mutex site_tables_mutex;
+
+extern "C" void __archer_profile_access(const site_t *site, const void *addr,
+                                        uint64_t size){
+    site_table_t *table = this_site_table;
+    if (!table) {
+        table = new site_table_t;
+        site_tables_mutex.lock();
+        if (!all_site_tables)
+            all_site_tables = new std::vector<site_table_t *>;
+        all_site_tables->push_back(table);
+        site_tables_mutex.unlock();
+        this_site_table = table;
+    }
+    site_entry_t &entry = table->entries[site];
+    uintptr_t begin = (uintptr_t)addr;
+    if (entry.count++ == 0 || begin < entry.begin)
+        entry.begin = begin;
+    if (begin + size > entry.end)
+        entry.end = begin + size;
+}
+
+typedef std::pair<uintptr_t, uintptr_t> range_t;
+
+// Returns the sorted, disjoint address ranges that more than one thread
+// accessed, given the ranges of all sites per thread.
+static std::vector<range_t> shared_ranges(std::vector<std::vector<range_t>> &threads){
+    // +1 where a thread starts covering an address, -1 where it stops.
+    // Ends sort before begins at the same address, the ranges are half
+    // open.
+    std::vector<std::pair<uintptr_t, int>> bounds;
+    for (std::vector<range_t> &ranges : threads) {
+        std::sort(ranges.begin(), ranges.end());
+        uintptr_t begin = 0, end = 0;
+        for (range_t &range : ranges) {
+            if (range.first >= range.second)
+                continue;
+            if (end > begin && range.first <= end) {
+                end = std::max(end, range.second);
+                continue;
+            }
+            if (end > begin) {
+                bounds.push_back(std::make_pair(begin, 1));
+                bounds.push_back(std::make_pair(end, -1));
+            }
+            begin = range.first;
+            end = range.second;
+        }
+        if (end > begin) {
+            bounds.push_back(std::make_pair(begin, 1));
+            bounds.push_back(std::make_pair(end, -1));
+        }
+    }
+    std::sort(bounds.begin(), bounds.end());
+
+    std::vector<range_t> shared;
+    int covered = 0;
+    for (auto &bound : bounds) {
+        covered += bound.second;
+        if (bound.second > 0 && covered == 2)
+            shared.push_back(std::make_pair(bound.first, bound.first));
+        else if (bound.second < 0 && covered == 1)
+            shared.back().second = bound.first;
+    }
+    return shared;
+}
+
+static bool overlaps(const std::vector<range_t> &shared, const range_t &range){
+    auto it = std::upper_bound(shared.begin(), shared.end(), range.first,
+                               [](uintptr_t addr, const range_t &r) { return addr < r.second; });
+    return it != shared.end() && it->first < range.second;
+}
+
+void sites_write(){
+    struct merged_t {
+        uint64_t count;
+        std::vector<range_t> ranges;
+    };
+    std::unordered_map<const site_t *, merged_t> merged;
+    std::vector<std::vector<range_t>> threads;
+    site_tables_mutex.lock();
+    if (all_site_tables)
+        for (site_table_t *table : *all_site_tables) {
+            threads.emplace_back();
+            for (auto &it : table->entries) {
+                merged_t &site = merged[it.first];
+                range_t range = std::make_pair(it.second.begin, it.second.end);
+                site.count += it.second.count;
+                site.ranges.push_back(range);
+                threads.back().push_back(range);
+            }
+        }
+    site_tables_mutex.unlock();
+    if (merged.empty())
+        return;
+    std::vector<range_t> shared = shared_ranges(threads);
+
+    char name[64];
+    snprintf(name, sizeof(name), "archer_sites.%d", getpid());
+    FILE *file = fopen(name, "w");
+    if (!file) {
+        perror(name);
+        return;
+    }
+    for (auto &it : merged) {
+        // The site only touched thread-private data if no other thread
+        // accessed its ranges, through this or any other site.
+        int single = 1;
+        for (range_t &range : it.second.ranges)
+            if (overlaps(shared, range))
+                single = 0;
+        fprintf(file, "%s\t%s\t%" PRIu64 "\t%" PRIu64 "\t%d\n", it.first->module,
+                it.first->function, it.first->ordinal, it.second.count, single);
+    }
+    fclose(file);
+}
+
+__attribute__((destructor)) static void sites_fini(){
+    sites_write();
+}
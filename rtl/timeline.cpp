@@ -0,0 +1,130 @@
+/*
+Copyright (c) 2015-2019, Lawrence Livermore National Security, LLC.
+
+Produced at the Lawrence Livermore National Laboratory
+
+Written by Simone Atzeni (simone@cs.utah.edu), Joachim Protze
+(joachim.protze@tu-dresden.de), Jonas Hahnfeld
+(hahnfeld@itc.rwth-aachen.de), Ganesh Gopalakrishnan, Zvonimir
+Rakamaric, Dong H. Ahn, Gregory L. Lee, Ignacio Laguna, and Martin
+Schulz.
+
+LLNL-CODE-773957
+
+All rights reserved.
+
+This file is part of Archer. For details, see
+https://pruners.github.io/archer. Please also read
+https://github.com/PRUNERS/archer/blob/master/LICENSE.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+   Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the disclaimer below.
+
+   Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the disclaimer (as noted below)
+   in the documentation and/or other materials provided with the
+   distribution.
+
+   Neither the name of the LLNS/LLNL nor the names of its contributors
+   may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LAWRENCE
+LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "timeline.h"
+#include "profile.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <inttypes.h>
+#include <mutex>
+#include <set>
+#include <stdio.h>
+#include <thread>
+#include <unistd.h>
+
+static std::thread *timeline_thread;
+static std::mutex timeline_mutex;
+static std::condition_variable timeline_cv;
+static bool timeline_done;
+static FILE *timeline_file;
+static std::set<const void *> timeline_regions;
+
+static long current_rss(){
+    long pages = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm) {
+        if (fscanf(statm, "%*s %ld", &pages) != 1)
+            pages = 0;
+        fclose(statm);
+    }
+    return pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static void timeline_loop(int interval_ms, timeline_sample_fn sample_fn){
+    uint64_t start = profile_now();
+    std::unique_lock<std::mutex> lock(timeline_mutex);
+    do {
+        timeline_sample_t sample = {};
+        sample.rss = current_rss();
+        sample_fn(&sample);
+        if (sample.region)
+            timeline_regions.insert(sample.region);
+        fprintf(timeline_file, "%" PRIu64 ",%ld,%d,%d,%d,%d,%d,%d,%d,%" PRIu64 ",%p\n",
+                (profile_now() - start) / 1000000, sample.rss,
+                sample.parallel_data_total, sample.parallel_data_used,
+                sample.taskgroup_total, sample.taskgroup_used,
+                sample.task_data_total, sample.task_data_used,
+                sample.locks, sample.shadow_flushes, sample.region);
+    } while (!timeline_cv.wait_for(lock, std::chrono::milliseconds(interval_ms),
+                                   [] { return timeline_done; }));
+}
+
+void timeline_start(int interval_ms, timeline_sample_fn sample_fn){
+    char filename[64];
+    snprintf(filename, sizeof(filename), "archer_memory.%d.csv", getpid());
+    timeline_file = fopen(filename, "w");
+    if (!timeline_file) {
+        fprintf(stderr, "Archer: could not open memory timeline %s\n", filename);
+        return;
+    }
+    fprintf(timeline_file, "time_ms,rss_kb,parallel_data_total,parallel_data_used,"
+            "taskgroup_total,taskgroup_used,task_data_total,task_data_used,"
+            "locks,shadow_flushes,region\n");
+    timeline_thread = new std::thread(timeline_loop, interval_ms, sample_fn);
+}
+
+void timeline_stop(){
+    if (!timeline_thread)
+        return;
+    timeline_mutex.lock();
+    timeline_done = true;
+    timeline_mutex.unlock();
+    timeline_cv.notify_one();
+    timeline_thread->join();
+    delete timeline_thread;
+    timeline_thread = NULL;
+
+    char location[1024];
+    for (const void *region : timeline_regions) {
+        profile_symbolize(region, location, sizeof(location));
+        fprintf(timeline_file, "# %p %s\n", region, location);
+    }
+    fclose(timeline_file);
+}
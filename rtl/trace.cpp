@@ -0,0 +1,116 @@
+/*
+Copyright (c) 2015-2019, Lawrence Livermore National Security, LLC.
+
+Produced at the Lawrence Livermore National Laboratory
+
+Written by Simone Atzeni (simone@cs.utah.edu), Joachim Protze
+(joachim.protze@tu-dresden.de), Jonas Hahnfeld
+(hahnfeld@itc.rwth-aachen.de), Ganesh Gopalakrishnan, Zvonimir
+Rakamaric, Dong H. Ahn, Gregory L. Lee, Ignacio Laguna, and Martin
+Schulz.
+
+LLNL-CODE-773957
+
+All rights reserved.
+
+This file is part of Archer. For details, see
+https://pruners.github.io/archer. Please also read
+https://github.com/PRUNERS/archer/blob/master/LICENSE.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+   Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the disclaimer below.
+
+   Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the disclaimer (as noted below)
+   in the documentation and/or other materials provided with the
+   distribution.
+
+   Neither the name of the LLNS/LLNL nor the names of its contributors
+   may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LAWRENCE
+LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "trace.h"
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <mutex>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+__thread trace_buffer_t *this_trace_buffer;
+
+static trace_buffer_t *all_trace_buffers;
+static std::mutex trace_buffers_mutex;
+
+trace_buffer_t *trace_open(uint64_t thread_id, int size_mb){
+    uint64_t capacity = 1;
+    while (capacity * 2 * sizeof(trace_record_t) <= ((uint64_t)size_mb << 20))
+        capacity *= 2;
+    size_t size = sizeof(trace_header_t) + capacity * sizeof(trace_record_t);
+
+    char filename[64];
+    snprintf(filename, sizeof(filename), "archer_trace.%d.%" PRIu64, getpid(), thread_id);
+    int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Archer: could not open trace file %s\n", filename);
+        return NULL;
+    }
+    // The file is sparse, pages are only allocated when records are written.
+    if (ftruncate(fd, size) != 0) {
+        fprintf(stderr, "Archer: could not resize trace file %s\n", filename);
+        close(fd);
+        return NULL;
+    }
+    void *mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "Archer: could not map trace file %s\n", filename);
+        return NULL;
+    }
+
+    trace_buffer_t *buffer = new trace_buffer_t;
+    buffer->header = (trace_header_t *)mapping;
+    buffer->header->magic = TRACE_MAGIC;
+    buffer->header->version = TRACE_VERSION;
+    buffer->header->thread_id = thread_id;
+    buffer->header->capacity = capacity;
+    buffer->header->head = 0;
+    buffer->records = (trace_record_t *)((char *)mapping + sizeof(trace_header_t));
+    buffer->mask = capacity - 1;
+    buffer->size = size;
+
+    trace_buffers_mutex.lock();
+    buffer->next = all_trace_buffers;
+    all_trace_buffers = buffer;
+    trace_buffers_mutex.unlock();
+    return buffer;
+}
+
+// The buffers stay mapped: other threads may still record events, e.g.
+// thread_end, after the tool was finalized. The mappings go away with
+// the process.
+void trace_flush_all(){
+    trace_buffers_mutex.lock();
+    for (trace_buffer_t *buffer = all_trace_buffers; buffer; buffer = buffer->next)
+        msync(buffer->header, buffer->size, MS_ASYNC);
+    trace_buffers_mutex.unlock();
+}
@@ -0,0 +1,131 @@
+/*
+Copyright (c) 2015-2019, Lawrence Livermore National Security, LLC.
+
+Produced at the Lawrence Livermore National Laboratory
+
+Written by Simone Atzeni (simone@cs.utah.edu), Joachim Protze
+(joachim.protze@tu-dresden.de), Jonas Hahnfeld
+(hahnfeld@itc.rwth-aachen.de), Ganesh Gopalakrishnan, Zvonimir
+Rakamaric, Dong H. Ahn, Gregory L. Lee, Ignacio Laguna, and Martin
+Schulz.
+
+LLNL-CODE-773957
+
+All rights reserved.
+
+This file is part of Archer. For details, see
+https://pruners.github.io/archer. Please also read
+https://github.com/PRUNERS/archer/blob/master/LICENSE.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+   Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the disclaimer below.
+
+   Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the disclaimer (as noted below)
+   in the documentation and/or other materials provided with the
+   distribution.
+
+   Neither the name of the LLNS/LLNL nor the names of its contributors
+   may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LAWRENCE
+LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+#define TRACE_MAGIC 0x41524348 // "ARCH"
+#define TRACE_VERSION 1
+
+#define TRACE_EVENT(kind,endpoint,subkind,id,other_id,codeptr) if(this_trace_buffer) trace_event(this_trace_buffer, trace_##kind, endpoint, subkind, (uint64_t)(id), (uint64_t)(other_id), codeptr)
+
+// Keep in sync with tools/archer-trace-convert
+typedef enum {
+    trace_thread_begin = 1,
+    trace_parallel_begin = 2,
+    trace_parallel_end = 3,
+    trace_implicit_task = 4,
+    trace_sync_region = 5,
+    trace_task_create = 6,
+    trace_task_schedule = 7,
+    trace_task_dependences = 8,
+    trace_work = 9,
+    trace_reduction = 10,
+    trace_mutex_acquired = 11,
+    trace_mutex_released = 12
+} trace_event_kind_t;
+
+typedef struct {
+    uint64_t time;				// CLOCK_MONOTONIC in ns
+    uint16_t kind;				// trace_event_kind_t
+    uint16_t endpoint;				// ompt_scope_endpoint_t or 0
+    uint32_t subkind;				// sync region kind, task type, task status, ...
+    uint64_t id;				// ParallelData, TaskData or wait_id
+    uint64_t other_id;				// second ParallelData or TaskData
+    uint64_t codeptr;				// codeptr_ra
+} trace_record_t;
+
+typedef struct alignas(64) {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t thread_id;
+    uint64_t capacity;				// number of records, power of two
+    volatile uint64_t head;			// number of records written so far
+} trace_header_t;
+
+typedef struct trace_buffer_t {
+    trace_header_t *header;
+    trace_record_t *records;
+    uint64_t mask;
+    size_t size;				// size of the mapping in bytes
+    struct trace_buffer_t *next;
+} trace_buffer_t;
+
+extern __thread trace_buffer_t *this_trace_buffer;
+
+// Only the owning thread writes to its buffer, once the buffer is full the
+// oldest records are overwritten.
+static inline void trace_event(trace_buffer_t *buffer, trace_event_kind_t kind,
+                               int endpoint, int subkind, uint64_t id,
+                               uint64_t other_id, const void *codeptr) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t head = buffer->header->head;
+    trace_record_t *record = &buffer->records[head & buffer->mask];
+    record->time = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    record->kind = kind;
+    record->endpoint = endpoint;
+    record->subkind = subkind;
+    record->id = id;
+    record->other_id = other_id;
+    record->codeptr = (uint64_t)codeptr;
+    buffer->header->head = head + 1;
+}
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+trace_buffer_t *trace_open(uint64_t thread_id, int size_mb);
+void trace_flush_all();
+
+#ifdef  __cplusplus
+}
+#endif
@@ -0,0 +1,87 @@
+/*
+Copyright (c) 2015-2019, Lawrence Livermore National Security, LLC.
+
+Produced at the Lawrence Livermore National Laboratory
+
+Written by Simone Atzeni (simone@cs.utah.edu), Joachim Protze
+(joachim.protze@tu-dresden.de), Jonas Hahnfeld
+(hahnfeld@itc.rwth-aachen.de), Ganesh Gopalakrishnan, Zvonimir
+Rakamaric, Dong H. Ahn, Gregory L. Lee, Ignacio Laguna, and Martin
+Schulz.
+
+LLNL-CODE-773957
+
+All rights reserved.
+
+This file is part of Archer. For details, see
+https://pruners.github.io/archer. Please also read
+https://github.com/PRUNERS/archer/blob/master/LICENSE.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+   Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the disclaimer below.
+
+   Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the disclaimer (as noted below)
+   in the documentation and/or other materials provided with the
+   distribution.
+
+   Neither the name of the LLNS/LLNL nor the names of its contributors
+   may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LAWRENCE
+LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// RUN: %libarcher-compile-sa -D'archer_no_check=no_sanitize("thread")' -Rpass=archer -Rpass-missed=archer 2>&1 | FileCheck %s
+// RUN: %libarcher-run | FileCheck %s --check-prefix=CHECK-RUN
+// REQUIRES: archer-static-analysis
+#include <omp.h>
+#include <stdio.h>
+
+#ifndef archer_no_check
+#define archer_no_check
+#endif
+
+int counter = 0;
+
+void __attribute__((archer_no_check)) kernel(void)
+{
+  #pragma omp parallel num_threads(2) shared(counter)
+  counter++;
+}
+
+int main(int argc, char* argv[])
+{
+  kernel();
+
+  #pragma omp parallel num_threads(2)
+  {
+    #pragma omp barrier
+  }
+
+  fprintf(stderr, "DONE\n");
+  return counter < 1;
+}
+
+// CHECK-NOT: kernel cloned
+// CHECK-NOT: no-check.c:64:{{[0-9]+}}: remark: uninstrumented copy
+// CHECK: no-check.c:72:{{[0-9]+}}: remark: uninstrumented copy for regions without an active parallel region
+// CHECK-NOT: kernel cloned
+// CHECK-NOT: no-check.c:64:{{[0-9]+}}: remark: uninstrumented copy
+// CHECK-RUN-NOT: ThreadSanitizer
+// CHECK-RUN: DONE
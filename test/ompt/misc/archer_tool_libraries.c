@@ -0,0 +1,58 @@
+// RUN: %clang %openmp_flags %flags -shared -fPIC -DCLIENT_TOOL %s -o %t.tool.so
+// RUN: %libarcher-compile && env ARCHER_TOOL_LIBRARIES=%t.tool.so %libarcher-run | FileCheck %s
+// REQUIRES: ompt
+// Archer forwards the events to a second tool with its own data and
+// passes the events it does not use through to the runtime.
+#ifdef CLIENT_TOOL
+#define ompt_start_tool callback_ompt_start_tool
+#include "callback.h"
+#undef ompt_start_tool
+
+static void on_ompt_callback_device_initialize(void) {}
+
+static int tool_initialize(ompt_function_lookup_t lookup,
+                           ompt_data_t *tool_data)
+{
+  int ret = ompt_initialize(lookup, tool_data);
+  if (ompt_set_callback(ompt_callback_device_initialize,
+                        (ompt_callback_t)&on_ompt_callback_device_initialize) ==
+      ompt_set_never)
+    printf("0: Could not register callback 'ompt_callback_device_initialize'\n");
+  return ret;
+}
+
+ompt_start_tool_result_t* ompt_start_tool(
+  unsigned int omp_version,
+  const char *runtime_version)
+{
+  static ompt_start_tool_result_t ompt_start_tool_result = {&tool_initialize,&ompt_finalize, 0};
+  return &ompt_start_tool_result;
+}
+#else
+#include <omp.h>
+#include <stdio.h>
+
+int main()
+{
+  int var = 0;
+
+  #pragma omp parallel num_threads(2) shared(var)
+  {
+    #pragma omp critical
+    var++;
+  }
+
+  return var != 2;
+}
+#endif
+
+// CHECK-NOT: WARNING: ThreadSanitizer: data race
+// CHECK: 0: NULL_POINTER=[[NULL:.*$]]
+// CHECK-NOT: 0: Could not register callback
+
+// CHECK-NOT: 0: parallel_data initially not null
+// CHECK-NOT: 0: task_data initially not null
+// CHECK-NOT: 0: thread_data initially not null
+
+// CHECK: {{^}}[[MASTER_ID:[0-9]+]]: ompt_event_parallel_begin: parent_task_id=[[PARENT_TASK_ID:[0-9]+]], {{.*}}, parallel_id=[[PARALLEL_ID:[0-9]+]], requested_team_size=2
+// CHECK: {{^}}[[MASTER_ID]]: ompt_event_parallel_end: parallel_id=[[PARALLEL_ID]], task_id=[[PARENT_TASK_ID]]
@@ -0,0 +1,127 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2015-2019, Lawrence Livermore National Security, LLC.
+#
+# Produced at the Lawrence Livermore National Laboratory
+#
+# Written by Simone Atzeni (simone@cs.utah.edu), Joachim Protze
+# (joachim.protze@tu-dresden.de), Jonas Hahnfeld
+# (hahnfeld@itc.rwth-aachen.de), Ganesh Gopalakrishnan, Zvonimir
+# Rakamaric, Dong H. Ahn, Gregory L. Lee, Ignacio Laguna, and Martin
+# Schulz.
+#
+# LLNL-CODE-773957
+#
+# All rights reserved.
+#
+# This file is part of Archer. For details, see
+# https://pruners.github.io/archer. Please also read
+# https://github.com/PRUNERS/archer/blob/master/LICENSE.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are
+# met:
+#
+#    Redistributions of source code must retain the above copyright
+#    notice, this list of conditions and the disclaimer below.
+#
+#    Redistributions in binary form must reproduce the above copyright
+#    notice, this list of conditions and the disclaimer (as noted below)
+#    in the documentation and/or other materials provided with the
+#    distribution.
+#
+#    Neither the name of the LLNS/LLNL nor the names of its contributors
+#    may be used to endorse or promote products derived from this
+#    software without specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+# "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+# LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+# A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LAWRENCE
+# LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR
+# CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+# EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+# PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+# PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+# LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+# NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+# SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+# Compare the run time and memory of a program built with and without Archer
+# against the thresholds of an overhead test. Invoked from lit tests as:
+# %libarcher-bench --max-slowdown 20 --max-rss-ratio 4
+# which is substituted by lit to:
+# overhead.py --tolerance <archer_perf_tolerance> --plain %t.plain --archer %t ...
+#
+# Every binary runs --repeat times and the fastest run counts. The memory of
+# the Archer run is taken from its print_max_rss output. The test fails if the
+# slowdown or the ratio of the RSS exceeds its threshold by more than the
+# tolerance.
+
+import argparse
+import os
+import re
+import subprocess
+import sys
+import time
+
+MAX_RSS = re.compile(r"MAX RSS\[KBytes\] during execution: (\d+)")
+
+
+def run(command, env):
+    """Return the wall time, the max RSS in KBytes and the output."""
+    start = time.time()
+    process = subprocess.Popen(command, env=env, stdout=subprocess.PIPE,
+                               stderr=subprocess.STDOUT)
+    output = process.stdout.read().decode(errors="replace")
+    _, status, usage = os.wait4(process.pid, 0)
+    elapsed = time.time() - start
+    if not os.WIFEXITED(status) or os.WEXITSTATUS(status) != 0:
+        sys.stdout.write(output)
+        sys.exit("%s failed with status %d" % (command[0], status))
+    return elapsed, usage.ru_maxrss, output
+
+
+def measure(command, repeat, env):
+    results = [run(command, env) for _ in range(repeat)]
+    return min(results, key=lambda result: result[0])
+
+
+def main(argv):
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--plain", required=True)
+    parser.add_argument("--archer", required=True)
+    parser.add_argument("--max-slowdown", type=float, required=True)
+    parser.add_argument("--max-rss-ratio", type=float, required=True)
+    parser.add_argument("--tolerance", type=float, default=0.25)
+    parser.add_argument("--repeat", type=int, default=3)
+    parser.add_argument("args", nargs="*")
+    args = parser.parse_args(argv[1:])
+
+    env = dict(os.environ)
+    plain_time, plain_rss, _ = measure([args.plain] + args.args, args.repeat, env)
+    env["ARCHER_OPTIONS"] = (env.get("ARCHER_OPTIONS", "") + " print_max_rss=1").strip()
+    archer_time, archer_rss, output = measure([args.archer] + args.args, args.repeat, env)
+    match = MAX_RSS.search(output)
+    if match:
+        archer_rss = int(match.group(1))
+
+    slowdown = archer_time / max(plain_time, 1e-6)
+    rss_ratio = float(archer_rss) / max(plain_rss, 1)
+    failed = False
+    for name, value, threshold in (("slowdown", slowdown, args.max_slowdown),
+                                   ("rss ratio", rss_ratio, args.max_rss_ratio)):
+        limit = threshold * (1 + args.tolerance)
+        status = "ok"
+        if value > limit:
+            status = "REGRESSION"
+            failed = True
+        print("%s: %.2f (threshold %.2f, limit %.2f) %s"
+              % (name, value, threshold, limit, status))
+    print("plain: %.3f s, %d KB; archer: %.3f s, %d KB"
+          % (plain_time, plain_rss, archer_time, archer_rss))
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
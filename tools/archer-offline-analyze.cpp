@@ -0,0 +1,550 @@
+/*
+Copyright (c) 2015-2019, Lawrence Livermore National Security, LLC.
+
+Produced at the Lawrence Livermore National Laboratory
+
+Written by Simone Atzeni (simone@cs.utah.edu), Joachim Protze
+(joachim.protze@tu-dresden.de), Jonas Hahnfeld
+(hahnfeld@itc.rwth-aachen.de), Ganesh Gopalakrishnan, Zvonimir
+Rakamaric, Dong H. Ahn, Gregory L. Lee, Ignacio Laguna, and Martin
+Schulz.
+
+LLNL-CODE-773957
+
+All rights reserved.
+
+This file is part of Archer. For details, see
+https://pruners.github.io/archer. Please also read
+https://github.com/PRUNERS/archer/blob/master/LICENSE.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+   Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the disclaimer below.
+
+   Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the disclaimer (as noted below)
+   in the documentation and/or other materials provided with the
+   distribution.
+
+   Neither the name of the LLNS/LLNL nor the names of its contributors
+   may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL LAWRENCE
+LIVERMORE NATIONAL SECURITY, LLC, THE U.S. DEPARTMENT OF ENERGY OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Analyzer for the memory access logs of the offline race detection backend
+// (libarcher_offline, see rtl/offline.h for the log format).
+//
+// Usage: archer-offline-analyze [-j threads] [-s shards] archer_log.<pid>.*
+//
+// 1. Every log is split into segments at its synchronization events.
+// 2. The synchronization events of all threads are replayed in the order of
+//    their sequence numbers to compute a vector clock for every segment.
+// 3. The address space is split into shards that are analyzed in parallel.
+//    For every 8 byte granule the accesses of concurrent segments of
+//    different threads are checked for conflicts. More shards than threads
+//    reduce the memory needed by the analysis.
+//
+// The exit code is 1 if a data race was found.
+
+#include "offline.h"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <mutex>
+#include <set>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+struct Segment {
+  uint32_t Thread;
+  /// Range of the segment in the log of the thread.
+  const uint8_t *Begin;
+  const uint8_t *End;
+  /// Decoder state at the begin of the segment.
+  uint64_t LastAddr;
+  uint64_t LastPc;
+  /// Sequence numbers of the events starting and ending the segment.
+  uint64_t StartSeq;
+  uint64_t EndSeq;
+};
+
+struct SyncEvent {
+  uint64_t Seq;
+  uint64_t Addr;
+  uint64_t Size;
+  uint32_t Thread;
+  uint8_t Tag;
+};
+
+struct ThreadLog {
+  std::string Filename;
+  const uint8_t *Data;
+  size_t Size;
+  uint64_t ThreadId;
+  std::vector<uint32_t> Segments;
+};
+
+struct Access {
+  uint64_t Addr;
+  uint64_t Size;
+  uint64_t Pc;
+  uint8_t Kind;
+};
+
+/// Accesses of one segment to one granule.
+struct Entry {
+  uint32_t Segment;
+  uint8_t Kind;
+  uint8_t Mask;
+  uint32_t Size;
+  uint64_t Addr;
+  uint64_t Pc;
+};
+
+struct Race {
+  Entry First;
+  Entry Second;
+};
+
+struct Mapping {
+  uint64_t Start;
+  uint64_t End;
+  uint64_t Offset;
+  std::string Path;
+};
+
+static std::vector<ThreadLog> Logs;
+static std::vector<Segment> Segments;
+/// Vector clocks of all segments, Logs.size() entries per segment.
+static std::vector<uint32_t> Clocks;
+/// New memory events sorted by address.
+static std::vector<SyncEvent> NewMemory;
+static uint64_t MaxNewMemorySize;
+
+static std::mutex RacesMutex;
+static std::set<std::pair<uint64_t, uint64_t>> ReportedPcs;
+static std::vector<Race> Races;
+
+static bool isWrite(uint8_t Kind) { return Kind & offline_write; }
+static bool isAtomic(uint8_t Kind) { return Kind & offline_atomic_read; }
+
+static const uint8_t *decodeAccess(const uint8_t *P, const uint8_t *End,
+                                   uint64_t &LastAddr, uint64_t &LastPc,
+                                   Access &A) {
+  uint8_t Tag = *P++;
+  int64_t AddrDelta, PcDelta;
+  if (!(P = offline_get_sleb(P, End, &AddrDelta)) ||
+      !(P = offline_get_sleb(P, End, &PcDelta)))
+    return NULL;
+  LastAddr += AddrDelta;
+  LastPc += PcDelta;
+  A.Addr = LastAddr;
+  A.Pc = LastPc;
+  A.Kind = Tag & 3;
+  unsigned SizeCode = Tag >> 2;
+  if (SizeCode == OFFLINE_SIZE_EXPLICIT) {
+    if (!(P = offline_get_uleb(P, End, &A.Size)))
+      return NULL;
+  } else
+    A.Size = 1 << SizeCode;
+  return P;
+}
+
+/// Map the log of thread T and split it into segments.
+static void readLog(uint32_t T, std::vector<SyncEvent> &Events) {
+  ThreadLog &Log = Logs[T];
+  int Fd = open(Log.Filename.c_str(), O_RDONLY);
+  struct stat St;
+  if (Fd < 0 || fstat(Fd, &St) != 0) {
+    fprintf(stderr, "Could not open %s\n", Log.Filename.c_str());
+    exit(2);
+  }
+  Log.Size = St.st_size;
+  void *Data = MAP_FAILED;
+  if (Log.Size >= sizeof(offline_log_header_t))
+    Data = mmap(NULL, Log.Size, PROT_READ, MAP_PRIVATE, Fd, 0);
+  close(Fd);
+  offline_log_header_t *Header = (offline_log_header_t *)Data;
+  if (Data == MAP_FAILED || Header->magic != OFFLINE_MAGIC ||
+      Header->version != OFFLINE_VERSION) {
+    fprintf(stderr, "%s is not an Archer offline log\n", Log.Filename.c_str());
+    exit(2);
+  }
+  Log.Data = (const uint8_t *)Data;
+  Log.ThreadId = Header->thread_id;
+
+  const uint8_t *P = Log.Data + sizeof(*Header);
+  const uint8_t *End = Log.Data + Log.Size;
+  uint64_t LastAddr = 0, LastPc = 0;
+  Segment Current = {T, P, End, 0, 0, 0, UINT64_MAX};
+  // A truncated event at the end of the log is ignored.
+  while (P && P < End) {
+    if (*P < OFFLINE_TAG_RELEASE) {
+      Access A;
+      const uint8_t *Next = decodeAccess(P, End, LastAddr, LastPc, A);
+      if (!Next)
+        Current.End = P;
+      P = Next;
+      continue;
+    }
+    SyncEvent Event = {0, 0, 0, T, *P};
+    const uint8_t *Next = P + 1;
+    if (!(Next = offline_get_uleb(Next, End, &Event.Addr)) ||
+        (Event.Tag == OFFLINE_TAG_NEW_MEMORY &&
+         !(Next = offline_get_uleb(Next, End, &Event.Size))) ||
+        !(Next = offline_get_uleb(Next, End, &Event.Seq))) {
+      Current.End = P;
+      break;
+    }
+    Events.push_back(Event);
+    Current.End = P;
+    Current.EndSeq = Event.Seq;
+    Log.Segments.push_back(Segments.size());
+    Segments.push_back(Current);
+
+    P = Next;
+    Current = {T, P, End, LastAddr, LastPc, Event.Seq, UINT64_MAX};
+  }
+  Log.Segments.push_back(Segments.size());
+  Segments.push_back(Current);
+}
+
+/// Replay the synchronization events of all threads to compute the vector
+/// clocks of the segments.
+static void computeClocks(std::vector<SyncEvent> &Events) {
+  size_t N = Logs.size();
+  std::sort(Events.begin(), Events.end(),
+            [](const SyncEvent &A, const SyncEvent &B) { return A.Seq < B.Seq; });
+
+  std::vector<std::vector<uint32_t>> ThreadClocks(N, std::vector<uint32_t>(N));
+  std::vector<size_t> CurrentSegment(N);
+  std::unordered_map<uint64_t, std::vector<uint32_t>> SyncClocks;
+  Clocks.resize(Segments.size() * N);
+  for (size_t T = 0; T < N; T++)
+    ThreadClocks[T][T] = 1;
+
+  auto StoreClock = [&](size_t T) {
+    uint32_t S = Logs[T].Segments[CurrentSegment[T]];
+    std::copy(ThreadClocks[T].begin(), ThreadClocks[T].end(),
+              Clocks.begin() + S * N);
+  };
+  for (size_t T = 0; T < N; T++)
+    StoreClock(T);
+
+  for (const SyncEvent &Event : Events) {
+    std::vector<uint32_t> &Clock = ThreadClocks[Event.Thread];
+    if (Event.Tag == OFFLINE_TAG_RELEASE) {
+      std::vector<uint32_t> &Sync = SyncClocks[Event.Addr];
+      Sync.resize(N);
+      for (size_t T = 0; T < N; T++)
+        Sync[T] = std::max(Sync[T], Clock[T]);
+      Clock[Event.Thread]++;
+    } else if (Event.Tag == OFFLINE_TAG_ACQUIRE) {
+      auto Sync = SyncClocks.find(Event.Addr);
+      if (Sync != SyncClocks.end())
+        for (size_t T = 0; T < N; T++)
+          Clock[T] = std::max(Clock[T], Sync->second[T]);
+    } else {
+      NewMemory.push_back(Event);
+      MaxNewMemorySize = std::max(MaxNewMemorySize, Event.Size);
+    }
+    CurrentSegment[Event.Thread]++;
+    StoreClock(Event.Thread);
+  }
+
+  std::sort(NewMemory.begin(), NewMemory.end(),
+            [](const SyncEvent &A, const SyncEvent &B) { return A.Addr < B.Addr; });
+}
+
+static bool happensBefore(uint32_t A, uint32_t B) {
+  size_t N = Logs.size();
+  uint32_t T = Segments[A].Thread;
+  return Clocks[A * N + T] <= Clocks[B * N + T];
+}
+
+/// Is the memory of the granule reported as new between segments A and B?
+static bool separatedByNewMemory(uint64_t Granule, uint32_t A, uint32_t B) {
+  const Segment &First =
+      Segments[A].EndSeq <= Segments[B].EndSeq ? Segments[A] : Segments[B];
+  const Segment &Second = &First == &Segments[A] ? Segments[B] : Segments[A];
+  uint64_t Addr = Granule << 3;
+  uint64_t Low = Addr > MaxNewMemorySize ? Addr - MaxNewMemorySize : 0;
+  auto I = std::lower_bound(
+      NewMemory.begin(), NewMemory.end(), Low,
+      [](const SyncEvent &E, uint64_t Value) { return E.Addr < Value; });
+  for (; I != NewMemory.end() && I->Addr < Addr + 8; ++I)
+    if (I->Addr + I->Size > Addr && First.EndSeq <= I->Seq &&
+        I->Seq <= Second.StartSeq)
+      return true;
+  return false;
+}
+
+/// Only pairs with a write can race, so every write of the granule is
+/// compared with all entries, O(writes * entries). Data that is read in
+/// every segment does not make the check quadratic.
+static void checkGranule(uint64_t Granule, const std::vector<Entry> &Entries) {
+  std::vector<size_t> Writes;
+  for (size_t I = 0; I < Entries.size(); I++)
+    if (isWrite(Entries[I].Kind))
+      Writes.push_back(I);
+
+  for (size_t W : Writes) {
+    for (size_t J = 0; J < Entries.size(); J++) {
+      // Pairs of two writes are checked from the earlier one.
+      if (J == W || (J < W && isWrite(Entries[J].Kind)))
+        continue;
+      const Entry &First = Entries[std::min(W, J)];
+      const Entry &Second = Entries[std::max(W, J)];
+      if (isAtomic(First.Kind) && isAtomic(Second.Kind))
+        continue;
+      if (!(First.Mask & Second.Mask))
+        continue;
+      if (Segments[First.Segment].Thread == Segments[Second.Segment].Thread)
+        continue;
+      if (happensBefore(First.Segment, Second.Segment) ||
+          happensBefore(Second.Segment, First.Segment))
+        continue;
+      std::pair<uint64_t, uint64_t> Pcs(std::min(First.Pc, Second.Pc),
+                                        std::max(First.Pc, Second.Pc));
+      {
+        std::lock_guard<std::mutex> Lock(RacesMutex);
+        if (ReportedPcs.count(Pcs))
+          continue;
+      }
+      if (separatedByNewMemory(Granule, First.Segment, Second.Segment))
+        continue;
+      // Like ThreadSanitizer, report only one race per address.
+      std::lock_guard<std::mutex> Lock(RacesMutex);
+      if (ReportedPcs.insert(Pcs).second)
+        Races.push_back({First, Second});
+      return;
+    }
+  }
+}
+
+static uint64_t hashGranule(uint64_t Granule) {
+  // Spread neighbouring granules over the shards.
+  return (Granule >> 4) * 0x9e3779b97f4a7c15ULL >> 32;
+}
+
+static void analyzeShard(size_t Shard, size_t NumShards) {
+  std::unordered_map<uint64_t, std::vector<Entry>> Granules;
+  for (ThreadLog &Log : Logs) {
+    for (uint32_t S : Log.Segments) {
+      const Segment &Seg = Segments[S];
+      const uint8_t *P = Seg.Begin;
+      uint64_t LastAddr = Seg.LastAddr, LastPc = Seg.LastPc;
+      while (P && P < Seg.End) {
+        Access A;
+        P = decodeAccess(P, Seg.End, LastAddr, LastPc, A);
+        if (!P)
+          break;
+        // memcpy(d, s, 0) and empty ranges touch no memory.
+        if (A.Size == 0)
+          continue;
+        uint64_t Last = A.Addr + A.Size - 1;
+        for (uint64_t G = A.Addr >> 3; G <= Last >> 3; G++) {
+          if (hashGranule(G) % NumShards != Shard)
+            continue;
+          uint64_t Begin = std::max(A.Addr, G << 3) - (G << 3);
+          uint64_t End = std::min(Last, (G << 3) + 7) - (G << 3);
+          uint8_t Mask = (0xff >> (7 - End + Begin)) << Begin;
+          std::vector<Entry> &Entries = Granules[G];
+          // Merge repeated accesses of the segment with the same kind, the
+          // first pc is kept for the report.
+          bool Merged = false;
+          for (auto E = Entries.rbegin();
+               E != Entries.rend() && E->Segment == S; ++E)
+            if (E->Kind == A.Kind) {
+              E->Mask |= Mask;
+              Merged = true;
+              break;
+            }
+          if (!Merged)
+            Entries.push_back({S, A.Kind, Mask, (uint32_t)A.Size, A.Addr, A.Pc});
+        }
+      }
+    }
+  }
+  for (auto &Granule : Granules)
+    if (Granule.second.size() > 1)
+      checkGranule(Granule.first, Granule.second);
+}
+
+static std::vector<Mapping> readMaps(const std::string &Filename) {
+  std::vector<Mapping> Maps;
+  FILE *F = fopen(Filename.c_str(), "r");
+  if (!F)
+    return Maps;
+  char Line[4096];
+  while (fgets(Line, sizeof(Line), F)) {
+    Mapping M;
+    char Perms[8];
+    int PathOffset = 0;
+    if (sscanf(Line, "%" SCNx64 "-%" SCNx64 " %7s %" SCNx64 " %*s %*s %n",
+               &M.Start, &M.End, Perms, &M.Offset, &PathOffset) < 4 ||
+        !PathOffset || Line[PathOffset] != '/')
+      continue;
+    M.Path = Line + PathOffset;
+    M.Path.erase(M.Path.find_last_not_of("\n") + 1);
+    Maps.push_back(M);
+  }
+  fclose(F);
+  return Maps;
+}
+
+/// Load address of a position independent module, 0 otherwise.
+static uint64_t loadAddress(const std::vector<Mapping> &Maps,
+                            const std::string &Path) {
+  uint16_t Type = 0;
+  FILE *F = fopen(Path.c_str(), "r");
+  if (F) {
+    if (fseek(F, 16, SEEK_SET) != 0 || fread(&Type, 2, 1, F) != 1)
+      Type = 0;
+    fclose(F);
+  }
+  if (Type != 3) // ET_DYN
+    return 0;
+  for (const Mapping &M : Maps)
+    if (M.Path == Path && M.Offset == 0)
+      return M.Start;
+  return 0;
+}
+
+static std::string symbolize(const std::vector<Mapping> &Maps, uint64_t Pc) {
+  char Buffer[4096];
+  for (const Mapping &M : Maps) {
+    if (Pc < M.Start || Pc >= M.End)
+      continue;
+    // The return address points after the call of the instrumentation.
+    uint64_t Offset = Pc - 1 - loadAddress(Maps, M.Path);
+    std::string Result;
+    snprintf(Buffer, sizeof(Buffer),
+             "llvm-symbolizer --obj='%s' 0x%" PRIx64 " 2>/dev/null",
+             M.Path.c_str(), Offset);
+    FILE *P = popen(Buffer, "r");
+    if (P) {
+      char Function[1024], Location[1024];
+      if (fgets(Function, sizeof(Function), P) &&
+          fgets(Location, sizeof(Location), P) && Function[0] != '?') {
+        Function[strcspn(Function, "\n")] = 0;
+        Location[strcspn(Location, "\n")] = 0;
+        Result = std::string(Function) + " " + Location + " ";
+      }
+      pclose(P);
+    }
+    snprintf(Buffer, sizeof(Buffer), "(%s+0x%" PRIx64 ")", M.Path.c_str(),
+             Offset + 1);
+    return Result + Buffer;
+  }
+  snprintf(Buffer, sizeof(Buffer), "(0x%" PRIx64 ")", Pc);
+  return Buffer;
+}
+
+static const char *accessName(uint8_t Kind, bool Capitalize) {
+  static const char *Names[] = {"read", "write", "atomic read", "atomic write",
+                                "Read", "Write", "Atomic read", "Atomic write"};
+  return Names[Kind + (Capitalize ? 4 : 0)];
+}
+
+static void printAccess(const std::vector<Mapping> &Maps, const Entry &E,
+                        bool Previous) {
+  const ThreadLog &Log = Logs[Segments[E.Segment].Thread];
+  printf("  %s%s of size %u at 0x%" PRIx64 " by thread T%" PRIu64 ":\n",
+         Previous ? "Previous " : "", accessName(E.Kind, !Previous), E.Size,
+         E.Addr, Log.ThreadId);
+  printf("    #0 %s\n\n", symbolize(Maps, E.Pc).c_str());
+}
+
+static void usage() {
+  fprintf(stderr, "Usage: archer-offline-analyze [-j threads] [-s shards] "
+                  "archer_log.<pid>.*\n");
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  size_t NumWorkers = std::max(1u, std::thread::hardware_concurrency());
+  size_t NumShards = 0;
+  std::string MapsFile;
+  int Opt;
+  while ((Opt = getopt(argc, argv, "j:s:")) != -1) {
+    if (Opt == 'j' && atoi(optarg) > 0)
+      NumWorkers = atoi(optarg);
+    else if (Opt == 's' && atoi(optarg) > 0)
+      NumShards = atoi(optarg);
+    else
+      usage();
+  }
+  for (int I = optind; I < argc; I++) {
+    std::string Filename = argv[I];
+    size_t Dot = Filename.rfind('.');
+    if (Dot != std::string::npos && Filename.substr(Dot) == ".maps")
+      MapsFile = Filename;
+    else
+      Logs.push_back({Filename, NULL, 0, 0, {}});
+  }
+  if (Logs.empty())
+    usage();
+  if (MapsFile.empty()) {
+    MapsFile = Logs[0].Filename;
+    MapsFile = MapsFile.substr(0, MapsFile.rfind('.')) + ".maps";
+  }
+  if (!NumShards)
+    NumShards = NumWorkers;
+
+  std::vector<SyncEvent> Events;
+  for (uint32_t T = 0; T < Logs.size(); T++)
+    readLog(T, Events);
+  computeClocks(Events);
+
+  std::vector<std::thread> Workers;
+  for (size_t W = 0; W < std::min(NumWorkers, NumShards); W++)
+    Workers.emplace_back([=] {
+      for (size_t Shard = W; Shard < NumShards; Shard += NumWorkers)
+        analyzeShard(Shard, NumShards);
+    });
+  for (std::thread &Worker : Workers)
+    Worker.join();
+
+  std::vector<Mapping> Maps = readMaps(MapsFile);
+  for (const Race &R : Races) {
+    printf("==================\n");
+    printf("WARNING: Archer offline: data race\n");
+    const Entry &Later = Segments[R.First.Segment].StartSeq >
+                                 Segments[R.Second.Segment].StartSeq
+                             ? R.First
+                             : R.Second;
+    const Entry &Earlier = &Later == &R.First ? R.Second : R.First;
+    printAccess(Maps, Later, false);
+    printAccess(Maps, Earlier, true);
+    printf("==================\n");
+  }
+  printf("Archer offline: reported %zu warnings\n", Races.size());
+  return Races.empty() ? 0 : 1;
+}